@@ -24,7 +24,9 @@ void setup1() {
 
 void loop1() {
   Iono.process();
-  delay(1);
+  // wake up at the next soft-PWM edge, at least every millisecond
+  unsigned long next = Iono.pwmNextUs();
+  delayMicroseconds(next < 1000 ? next : 1000);
 }
 
 void setup() {
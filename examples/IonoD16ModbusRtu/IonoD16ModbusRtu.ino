@@ -27,7 +27,9 @@ void setup1() {
 
 void loop1() {
   Iono.process();
-  delay(1);
+  // wake up at the next soft-PWM edge, at least every millisecond
+  unsigned long next = Iono.pwmNextUs();
+  delayMicroseconds(next < 1000 ? next : 1000);
 }
 
 void setup() {
@@ -41,28 +43,27 @@ void setup() {
               _cfgRegisters[MB_REG_CFG_OFFSET_MB_BAUD],
               _cfgRegisters[MB_REG_CFG_OFFSET_MB_PARITY]);
 
-  Iono.outputsJoin(D1, false);
-  Iono.outputsJoin(D5, false);
-  Iono.outputsJoin(D9, false);
-  Iono.outputsJoin(D13, false);
+  Iono.eventsDebounceSet(EV_DEBOUNCE_MS);
+  Iono.eventsEnable(true);
 
+  IonoD16PinConfig pins[16];
   for (int d = D1; d <= D16; d++) {
     word mode = _cfgRegisters[MB_REG_CFG_OFFSET_MODE_D1 + (d - D1)];
+    IonoD16PinConfig* p = &pins[d - D1];
+    p->join = false;
     switch (mode) {
-      case 1:
-        Iono.pinMode(d, INPUT, false);
-        break;
-      case 2:
-        Iono.pinMode(d, INPUT, true);
-        break;
       case 3:
-        Iono.pinMode(d, OUTPUT_HS, false);
-        break;
       case 4:
-        Iono.pinMode(d, OUTPUT_HS, true);
+        p->mode = OUTPUT_HS;
+        p->wbol = mode == 4;
         break;
       case 6:
-        Iono.pinMode(d, OUTPUT_PP);
+        p->mode = OUTPUT_PP;
+        p->wbol = false;
+        break;
+      default:
+        p->mode = INPUT;
+        p->wbol = mode == 2;
         break;
     }
   }
@@ -70,16 +71,23 @@ void setup() {
   for (int d = D2; d <= D16; d += 2) {
     word modePre = _cfgRegisters[MB_REG_CFG_OFFSET_MODE_D1 + (d - D1) - 1];
     word mode = _cfgRegisters[MB_REG_CFG_OFFSET_MODE_D1 + (d - D1)];
-    if (mode == 5) {
-      if (modePre == 3) {
-        Iono.pinMode(d, OUTPUT_HS, false);
-      } else if (modePre == 4) {
-        Iono.pinMode(d, OUTPUT_HS, true);
-      }
-      Iono.outputsJoin(d);
+    if (mode == 5 && (modePre == 3 || modePre == 4)) {
+      pins[d - D1] = pins[d - D1 - 1];
     }
   }
 
+  // joins not allowed by the other pins' modes are dropped, keeping the
+  // pair as two independent outputs
+  for (int d = D2; d <= D16; d += 2) {
+    word mode = _cfgRegisters[MB_REG_CFG_OFFSET_MODE_D1 + (d - D1)];
+    if (mode == 5 && Iono.outputsJoinable(d, pins)) {
+      pins[d - D1].join = true;
+    }
+  }
+
+  // a failure is reported in the Modbus error word, not retried
+  modbusConfigured(Iono.configure(pins));
+
   for (int d = D1; d <= D16; d++) {
     word in = _cfgRegisters[MB_REG_CFG_OFFSET_LINK_D1 + (d - D1)];
     if (in >= D1 && in <= D16) {
@@ -10,6 +10,7 @@
 //#define CFG_MB_BAUDRATE     6 // 38400
 //#define CFG_MB_BAUDRATE     7 // 57600
 //#define CFG_MB_BAUDRATE     8 // 115200
+//#define CFG_MB_BAUDRATE     9 // 230400
 
 // == Modbus serial parity and stop bits ==
 #define CFG_MB_PARITY       1 // parity even, 1 stop bit
@@ -95,6 +96,8 @@
 
 #define LINK_DEBOUNCE_MS 25
 
+#define EV_DEBOUNCE_MS 25
+
 #include <EEPROM.h>
 
 bool configReset = false;
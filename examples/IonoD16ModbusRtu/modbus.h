@@ -1,5 +1,4 @@
-#include <ModbusRtuSlave.h>
-#include <Wiegand.h>
+#include "rtu.h"
 
 #define MB_REG_CFG_START               1000
 #define MB_REG_CFG_OFFSET_COMMIT       0
@@ -61,6 +60,25 @@
 
 #define MB_REG_CFG_OFFSET_MAX          MB_REG_CFG_OFFSET_RULE_D16
 
+#define MB_REG_DIAG_START              1101
+#define MB_REG_DIAG_CLR_START          1201
+#define MB_DIAG_WORDS                  12
+#define MB_DIAG_ERR_CONFIG             0x10
+
+#define MB_REG_EV_LOST                 1301
+#define MB_REG_EV_START                1302
+#define MB_EV_WORDS                    4
+#define MB_EV_MAX                      7
+
+#define MB_REG_OUTPUTS                 1401
+#define MB_REG_OUTPUTS_STAGED          1402
+#define MB_REG_OUTPUTS_COMMIT          1403
+#define MB_REG_PWM_START               1501
+
+#define MB_REG_STATS_RESET             1600
+#define MB_REG_STATS_START             1601
+#define MB_STATS_WORDS                 5
+
 static word _cfgRegisters[MB_REG_CFG_OFFSET_MAX + 1];
 
 bool _doEnabled[16];
@@ -69,6 +87,20 @@ unsigned long _doTime[16];
 
 static word _pwmFreq[16];
 
+static uint16_t _outputsMask;
+static bool _configError;
+
+static uint16_t _outputsStaged;
+static bool _outputsStagedValid;
+static bool _outputsApplyPending;
+static unsigned long _outputsApplyTs;
+
+// Events read from the library and not yet sent, the ones added to a
+// response are removed only once it has been transmitted
+static IonoD16Event _events[MB_EV_MAX];
+static int _eventsNum;
+static int _eventsServed;
+
 static bool _debounce[16];
 static word _counters[16];
 
@@ -79,256 +111,581 @@ static void _debounceCb(int pin, int val) {
   }
 }
 
-static Wiegand _wgnd[] = {Wiegand(DT1, DT2), Wiegand(DT3, DT4)};
+#define MB_WGND_FRAME_WORDS 11
+#define MB_WGND_FRAMES_MAX (125 / MB_WGND_FRAME_WORDS)
+
+static const int _wgndPinD0[] = {DT1, DT3};
 static uint64_t _wgndData[2];
 static bool _wgndInit[2];
 
-static void _wgnd0OnData0() {
-  _wgnd[0].onData0();
+#define MB_ACC_R_COIL       0x01
+#define MB_ACC_R_DISCRETE   0x02
+#define MB_ACC_W_COIL       0x04
+#define MB_ACC_R_INPUT      0x08
+#define MB_ACC_R_HOLDING    0x10
+#define MB_ACC_W_HOLDING    0x20
+#define MB_ACC_R_FIFO       0x40
+#define MB_ACC_W_MASK       0x80
+
+#define MB_ACC_BITS (MB_ACC_R_COIL | MB_ACC_R_DISCRETE | MB_ACC_W_COIL)
+
+// Handlers are called with the offset of the requested address from
+// the start of the range and the range's argument
+typedef byte (*mbHandler)(byte function, word offset, word qty, byte *data, int arg);
+
+struct mbRangeStr {
+  word start;
+  word end;
+  byte access;
+  mbHandler handler;
+  int arg;
+};
+
+static bool _checkAddrRange(word regAddr, word qty, word min, word max) {
+  return regAddr >= min && regAddr <= max && regAddr + qty <= max + 1;
 }
 
-static void _wgnd0OnData1() {
-  _wgnd[0].onData1();
+static uint16_t _mbMask(word offset, word qty) {
+  return ((1ul << qty) - 1) << offset;
 }
 
-static void _wgnd1OnData0() {
-  _wgnd[1].onData0();
+static void _mbResponseAddBits(uint16_t bits, word offset, word qty) {
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddBit((bits >> i) & 1);
+  }
 }
 
-static void _wgnd1OnData1() {
-  _wgnd[1].onData1();
+static byte _mbDigital(byte function, word offset, word qty, byte *data, int arg) {
+  if (function == MB_FC_READ_COILS || function == MB_FC_READ_DISCRETE_INPUTS) {
+    IonoD16Snapshot s;
+    Iono.snapshotRead(&s);
+    _mbResponseAddBits(s.inputs, offset, qty);
+    return MB_RESP_OK;
+  }
+  uint16_t values = 0;
+  for (int i = 0; i < qty; i++) {
+    if (rtuDataCoil(function, data, i)) {
+      values |= 1 << (offset + i);
+    }
+  }
+  return Iono.writeMask(_mbMask(offset, qty), values) ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
 }
 
-static void (*_wgndOnData0[])(void) = {&_wgnd0OnData0, &_wgnd1OnData0};
-static void (*_wgndOnData1[])(void) = {&_wgnd0OnData1, &_wgnd1OnData1};
+static byte _mbFault(byte function, word offset, word qty, byte *data, int arg) {
+  _mbResponseAddBits(Iono.faultsReadClearType(arg, _mbMask(offset, qty)), offset, qty);
+  return MB_RESP_OK;
+}
 
-static bool _checkAddrRange(word regAddr, word qty, word min, word max) {
-  return regAddr >= min && regAddr <= max && regAddr + qty <= max + 1;
+static byte _mbLock(byte function, word offset, word qty, byte *data, int arg) {
+  IonoD16Snapshot s;
+  Iono.snapshotRead(&s);
+  _mbResponseAddBits(arg == IONO_FAULT_OV ? s.overVoltageLock : s.thermalShutdownLock, offset, qty);
+  return MB_RESP_OK;
 }
 
-static byte _modbusOnRequest(byte unitAddr, byte function, word regAddr, word qty, byte *data) {
-  switch (function) {
-    case MB_FC_READ_DISCRETE_INPUTS:
-      if (_checkAddrRange(regAddr, qty, 101, 116)) {
-        for (int i = regAddr - 100; i < regAddr - 100 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.wireBreakRead(i));
-        }
-        return MB_RESP_OK;
+static byte _mbOutputs(byte function, word offset, word qty, byte *data, int arg) {
+  if (function == MB_FC_READ_HOLDING_REGISTERS) {
+    IonoD16Snapshot s;
+    Iono.snapshotRead(&s);
+    rtuResponseAddRegister(s.outputs);
+    return MB_RESP_OK;
+  }
+  if (function == MB_FC_MASK_WRITE_REGISTER) {
+    // only the bits with AND mask = 0 are changed, on output pins only
+    // as for FC6/FC16
+    uint16_t andMask = (data[0] << 8) | data[1];
+    uint16_t orMask = (data[2] << 8) | data[3];
+    return Iono.writeMask(~andMask & _outputsMask, orMask) ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
+  }
+  return Iono.writeMask(_outputsMask, rtuDataRegister(function, data, 0)) ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
+}
+
+static byte _mbOutputsStaged(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    word val = rtuDataRegister(function, data, i - offset);
+    if (i == 0) {
+      _outputsStaged = val;
+      _outputsStagedValid = true;
+    } else {
+      if (!_outputsStagedValid) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 201, 216)) {
-        for (int i = regAddr - 200; i < regAddr - 200 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.openLoadRead(i));
-        }
-        return MB_RESP_OK;
+      // applied by modbusProcess(), the delay is counted from when this
+      // unit handles the request, which depends on its loop latency
+      _outputsApplyTs = micros() + val * 1000ul;
+      _outputsApplyPending = true;
+      _outputsStagedValid = false;
+    }
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbDebounced(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddBit(_debounce[i]);
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbLed(byte function, word offset, word qty, byte *data, int arg) {
+  Iono.ledSet(rtuDataCoil(function, data, 0));
+  return MB_RESP_OK;
+}
+
+static byte _mbCfg(byte function, word offset, word qty, byte *data, int arg) {
+  if (function == MB_FC_READ_HOLDING_REGISTERS) {
+    for (int i = offset; i < offset + qty; i++) {
+      rtuResponseAddRegister(_cfgRegisters[i]);
+    }
+    return MB_RESP_OK;
+  }
+
+  bool commit = false;
+  for (int i = offset; i < offset + qty; i++) {
+    word val = rtuDataRegister(function, data, i - offset);
+    if (i == MB_REG_CFG_OFFSET_COMMIT) {
+      if (qty != 1 || val != CFG_COMMIT_VAL) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 301, 316)) {
-        for (int i = regAddr - 300; i < regAddr - 300 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.overVoltageRead(i));
-        }
-        return MB_RESP_OK;
+      commit = true;
+    } else if (i == MB_REG_CFG_OFFSET_MB_ADDR) {
+      if (val < 1 || val > 247) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 401, 416)) {
-        for (int i = regAddr - 400; i < regAddr - 400 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.overVoltageLockRead(i));
-        }
-        return MB_RESP_OK;
+    } else if (i == MB_REG_CFG_OFFSET_MB_BAUD) {
+      if (val < 1 || val > 9) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 501, 516)) {
-        for (int i = regAddr - 500; i < regAddr - 500 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.thermalShutdownRead(i));
-        }
-        return MB_RESP_OK;
+    } else if (i == MB_REG_CFG_OFFSET_MB_PARITY) {
+      if (val < 1 || val > 3) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 601, 616)) {
-        for (int i = regAddr - 600; i < regAddr - 600 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.thermalShutdownLockRead(i));
-        }
-        return MB_RESP_OK;
+    } else if (i >= MB_REG_CFG_OFFSET_MODE_D1 && i <= MB_REG_CFG_OFFSET_MODE_D16) {
+      if (val < 1 || val > 6) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 701, 716)) {
-        for (int i = regAddr - 700; i < regAddr - 700 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.alarmT1Read(i));
-        }
-        return MB_RESP_OK;
+    } else if (i >= MB_REG_CFG_OFFSET_LINK_D1 && i <= MB_REG_CFG_OFFSET_LINK_D16) {
+      if (val > 16) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      if (_checkAddrRange(regAddr, qty, 801, 816)) {
-        for (int i = regAddr - 800; i < regAddr - 800 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.alarmT2Read(i));
-        }
-        return MB_RESP_OK;
+    } else if (i >= MB_REG_CFG_OFFSET_RULE_D1 && i <= MB_REG_CFG_OFFSET_RULE_D16) {
+      if (val != 'F' && val != 'I' && val != 'H' && val != 'L' && val != 'T') {
+        return MB_EX_ILLEGAL_DATA_VALUE;
       }
-      // fall into case MB_FC_READ_COILS to have registers below
-      // readable with MB_FC_READ_DISCRETE_INPUTS too
+    }
+    _cfgRegisters[i] = val;
+  }
 
-    case MB_FC_READ_COILS:
-      if (_checkAddrRange(regAddr, qty, 1, 16)) {
-        for (int i = regAddr; i < regAddr + qty; i++) {
-          ModbusRtuSlave.responseAddBit(Iono.read(i));
-        }
-        return MB_RESP_OK;
-      }
-      if (_checkAddrRange(regAddr, qty, 24101, 2416)) {
-        for (int i = regAddr - 2400; i < regAddr - 2400 + qty; i++) {
-          ModbusRtuSlave.responseAddBit(_debounce[i - 1]);
-        }
-        return MB_RESP_OK;
-      }
-      return MB_EX_ILLEGAL_DATA_ADDRESS;
+  if (commit) {
+    configCommit(_cfgRegisters, MB_REG_CFG_OFFSET_MAX + 1);
+  }
 
-    case MB_FC_WRITE_MULTIPLE_COILS:
-    case MB_FC_WRITE_SINGLE_COIL:
-      if (_checkAddrRange(regAddr, qty, 1, 16)) {
-        bool ok = true;
-        for (int i = regAddr; i < regAddr + qty; i++) {
-          bool on = ModbusRtuSlave.getDataCoil(function, data, i - regAddr);
-          if (!Iono.write(i, on ? HIGH : LOW)) {
-            ok = false;
-          }
-        }
-        return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
-      }
-      if (regAddr == 3001 && qty == 1) {
-        bool on = ModbusRtuSlave.getDataCoil(function, data, 0);
-        Iono.ledSet(on);
-        return MB_RESP_OK;
-      }
-      return MB_EX_ILLEGAL_DATA_ADDRESS;
+  return MB_RESP_OK;
+}
 
-    case MB_FC_READ_INPUT_REGISTER:
-      if (_checkAddrRange(regAddr, qty, 2501, 2516)) {
-        for (int i = regAddr - 2500; i < regAddr - 2500 + qty; i++) {
-          ModbusRtuSlave.responseAddRegister(_counters[i - 1]);
-        }
-        return MB_RESP_OK;
-      }
-      if ((regAddr == 4001 || regAddr == 5001) && qty == 1) {
-        int idx = regAddr == 4001 ? 0 : 1;
-        if (!_wgndInit[idx]) {
-          _wgnd[idx].setup(_wgndOnData0[idx], _wgndOnData1[idx], false,
-            WGND_ITVL_MIN, WGND_ITVL_MAX, WGND_WIDTH_MIN, WGND_WIDTH_MAX);
-          _wgndInit[idx] = true;
-        }
-        ModbusRtuSlave.responseAddRegister(_wgnd[idx].getData(&_wgndData[idx]));
-        return MB_RESP_OK;
+static byte _mbPulse(byte function, word offset, word qty, byte *data, int arg) {
+  bool ok = true;
+  for (int i = offset; i < offset + qty; i++) {
+    _doTime[i] = 100 * rtuDataRegister(function, data, i - offset);
+    if (_doTime[i] > 0) {
+      _doEnabled[i] = true;
+      _doStart[i] = millis();
+      if (!Iono.write(i + 1, HIGH)) {
+        ok = false;
       }
-      if ((regAddr == 4002 || regAddr == 5002) && qty <= 4) {
-        int idx = regAddr == 4002 ? 0 : 1;
-        for (int i = 0; i < qty; i++) {
-          ModbusRtuSlave.responseAddRegister((_wgndData[idx] >> (i * 16)) & 0xffff);
-        }
-        return MB_RESP_OK;
-      }
-      if ((regAddr == 4010 || regAddr == 5010) && qty == 1) {
-        int idx = regAddr == 4010 ? 0 : 1;
-        ModbusRtuSlave.responseAddRegister(_wgnd[idx].getNoise());
-        return MB_RESP_OK;
+    }
+  }
+  return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
+}
+
+static byte _mbPwmFreq(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    _pwmFreq[i] = rtuDataRegister(function, data, i - offset);
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbPwmDuty(byte function, word offset, word qty, byte *data, int arg) {
+  bool ok = true;
+  for (int i = offset; i < offset + qty; i++) {
+    word duty = rtuDataRegister(function, data, i - offset);
+    if (!Iono.pwmSet(i + 1, _pwmFreq[i], duty)) {
+      ok = false;
+    }
+  }
+  return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
+}
+
+static byte _mbPwm(byte function, word offset, word qty, byte *data, int arg) {
+  // frequency and duty-cycle pairs, the output is updated once per pair
+  bool ok = true;
+  for (int i = offset; i < offset + qty; i++) {
+    word val = rtuDataRegister(function, data, i - offset);
+    if (i % 2 == 0) {
+      _pwmFreq[i / 2] = val;
+    } else if (!Iono.pwmSet(i / 2 + 1, _pwmFreq[i / 2], val)) {
+      ok = false;
+    }
+  }
+  return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
+}
+
+static byte _mbDebounceTime(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    word deb = rtuDataRegister(function, data, i - offset);
+    if (deb > 0) {
+      Iono.subscribe(i + 1, deb, _debounceCb);
+    } else {
+      Iono.subscribe(i + 1, 0, NULL);
+    }
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbDiag(byte function, word offset, word qty, byte *data, int arg) {
+  // Fault types reported at each offset of the block, cleared only
+  // when actually returned
+  static const int8_t faultAt[MB_DIAG_WORDS] = {
+    -1, -1, IONO_FAULT_WB, IONO_FAULT_OL, IONO_FAULT_OV, -1, IONO_FAULT_THSD, -1,
+    IONO_FAULT_ALRM_T1, IONO_FAULT_ALRM_T2, -1, -1
+  };
+  IonoD16Snapshot s;
+  byte types = 0;
+  if (arg != 0) {
+    for (int i = offset; i < offset + qty; i++) {
+      if (faultAt[i] >= 0) {
+        types |= 1 << faultAt[i];
       }
+    }
+    Iono.faultsReadClear(&s, types);
+  } else {
+    Iono.snapshotRead(&s);
+  }
+  const word words[MB_DIAG_WORDS] = {
+    s.inputs, s.outputs, s.wireBreak, s.openLoad, s.overVoltage, s.overVoltageLock,
+    s.thermalShutdown, s.thermalShutdownLock, s.alarmT1, s.alarmT2,
+    (word) (s.error | (_configError ? MB_DIAG_ERR_CONFIG : 0)),
+    (word) (s.seq & 0xffff)
+  };
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddRegister(words[i]);
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbEventsLost(byte function, word offset, word qty, byte *data, int arg) {
+  rtuResponseAddRegister(Iono.eventsLost() & 0xffff);
+  return MB_RESP_OK;
+}
+
+static byte _mbEvents(byte function, word offset, word qty, byte *data, int arg) {
+  int num;
+  if (offset != 0) {
+    return MB_EX_ILLEGAL_DATA_ADDRESS;
+  }
+  if (function == MB_FC_READ_FIFO_QUEUE) {
+    num = MB_EV_MAX;
+  } else {
+    if (qty % MB_EV_WORDS != 0) {
       return MB_EX_ILLEGAL_DATA_ADDRESS;
+    }
+    num = qty / MB_EV_WORDS;
+  }
+  if (_eventsNum < num) {
+    _eventsNum += Iono.eventsRead(_events + _eventsNum, num - _eventsNum);
+  }
+  if (function == MB_FC_READ_FIFO_QUEUE) {
+    num = _eventsNum;
+  }
+  for (int i = 0; i < num; i++) {
+    if (i >= _eventsNum) {
+      for (int j = 0; j < MB_EV_WORDS; j++) {
+        rtuResponseAddRegister(0);
+      }
+      continue;
+    }
+    IonoD16Event* e = &_events[i];
+    int pin = e->pin >= DT1 ? e->pin - DT1 + 17 : e->pin;
+    rtuResponseAddRegister((pin << 8) | (e->value == HIGH ? 1 : 0));
+    rtuResponseAddRegister(e->seq & 0xffff);
+    rtuResponseAddRegister(e->ts >> 16);
+    rtuResponseAddRegister(e->ts & 0xffff);
+  }
+  _eventsServed = num < _eventsNum ? num : _eventsNum;
+  return MB_RESP_OK;
+}
 
-    case MB_FC_READ_HOLDING_REGISTERS:
-      if (_checkAddrRange(regAddr, qty, MB_REG_CFG_START, MB_REG_CFG_START + MB_REG_CFG_OFFSET_MAX)) {
-        int offset = regAddr - MB_REG_CFG_START;
-        int offsetEnd = offset + qty;
-        for (int i = offset; i < offsetEnd; i++) {
-          ModbusRtuSlave.responseAddRegister(_cfgRegisters[i]);
-        }
-        return MB_RESP_OK;
+static word _mbSat16(uint32_t val) {
+  return val > 0xffff ? 0xffff : val;
+}
+
+static byte _mbStats(byte function, word offset, word qty, byte *data, int arg) {
+  IonoD16PhaseStats stats[IONO_PHASE_NUM];
+  word words[IONO_PHASE_NUM * MB_STATS_WORDS];
+  if (!Iono.stats(stats)) {
+    return MB_EX_ILLEGAL_DATA_ADDRESS;
+  }
+  for (int i = 0; i < IONO_PHASE_NUM; i++) {
+    words[i * MB_STATS_WORDS] = stats[i].count >> 16;
+    words[i * MB_STATS_WORDS + 1] = stats[i].count & 0xffff;
+    words[i * MB_STATS_WORDS + 2] = _mbSat16(stats[i].minUs);
+    words[i * MB_STATS_WORDS + 3] = _mbSat16(stats[i].avgUs);
+    words[i * MB_STATS_WORDS + 4] = _mbSat16(stats[i].maxUs);
+  }
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddRegister(words[i]);
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbStatsReset(byte function, word offset, word qty, byte *data, int arg) {
+  Iono.statsReset();
+  return MB_RESP_OK;
+}
+
+static byte _mbCounters(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddRegister(_counters[i]);
+  }
+  return MB_RESP_OK;
+}
+
+// Each interface is set up on the first read of its registers, leaving
+// DT1 ... DT4 free for other uses until then
+static void _wgndSetup(int idx) {
+  if (!_wgndInit[idx]) {
+    _wgndInit[idx] = Iono.wiegandSetup(_wgndPinD0[idx],
+        WGND_ITVL_MIN, WGND_ITVL_MAX, WGND_WIDTH_MIN, WGND_WIDTH_MAX);
+  }
+}
+
+static byte _mbWgndBits(byte function, word offset, word qty, byte *data, int arg) {
+  uint64_t wgndData;
+  _wgndSetup(arg);
+  int bits = Iono.wiegandRead(_wgndPinD0[arg], &wgndData, NULL);
+  if (bits > 0) {
+    _wgndData[arg] = wgndData;
+  }
+  rtuResponseAddRegister(bits);
+  return MB_RESP_OK;
+}
+
+static byte _mbWgndData(byte function, word offset, word qty, byte *data, int arg) {
+  for (int i = offset; i < offset + qty; i++) {
+    rtuResponseAddRegister((_wgndData[arg] >> (i * 16)) & 0xffff);
+  }
+  return MB_RESP_OK;
+}
+
+static byte _mbWgndNoise(byte function, word offset, word qty, byte *data, int arg) {
+  _wgndSetup(arg);
+  rtuResponseAddRegister(Iono.wiegandNoise(_wgndPinD0[arg]));
+  return MB_RESP_OK;
+}
+
+static byte _mbWgndAvailable(byte function, word offset, word qty, byte *data, int arg) {
+  _wgndSetup(arg);
+  rtuResponseAddRegister(Iono.wiegandAvailable(_wgndPinD0[arg]));
+  return MB_RESP_OK;
+}
+
+static byte _mbWgndFrames(byte function, word offset, word qty, byte *data, int arg) {
+  IonoD16WiegandFrame frames[MB_WGND_FRAMES_MAX];
+  int num = qty / MB_WGND_FRAME_WORDS;
+  if (offset != 0 || qty % MB_WGND_FRAME_WORDS != 0) {
+    return MB_EX_ILLEGAL_DATA_ADDRESS;
+  }
+  _wgndSetup(arg);
+  int n = Iono.wiegandReadFrames(_wgndPinD0[arg], frames, num);
+  for (int i = 0; i < num; i++) {
+    if (i >= n) {
+      for (int j = 0; j < MB_WGND_FRAME_WORDS; j++) {
+        rtuResponseAddRegister(0);
       }
-      return MB_EX_ILLEGAL_DATA_ADDRESS;
+      continue;
+    }
+    IonoD16WiegandFrame* f = &frames[i];
+    rtuResponseAddRegister(f->bits);
+    rtuResponseAddRegister(f->status);
+    rtuResponseAddRegister(f->facility);
+    rtuResponseAddRegister(f->card >> 16);
+    rtuResponseAddRegister(f->card & 0xffff);
+    rtuResponseAddRegister(f->ts >> 16);
+    rtuResponseAddRegister(f->ts & 0xffff);
+    for (int j = 0; j < 4; j++) {
+      rtuResponseAddRegister((f->data >> (j * 16)) & 0xffff);
+    }
+  }
+  return MB_RESP_OK;
+}
+
+// Register map, sorted by address, one table for the coils/discrete
+// inputs and one for the input/holding registers. The README tables
+// list the same ranges
+static constexpr struct mbRangeStr _mbBitsMap[] = {
+  {1, 16, MB_ACC_R_COIL | MB_ACC_R_DISCRETE | MB_ACC_W_COIL, _mbDigital, 0},
+  {101, 116, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_WB},
+  {201, 216, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_OL},
+  {301, 316, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_OV},
+  {401, 416, MB_ACC_R_DISCRETE, _mbLock, IONO_FAULT_OV},
+  {501, 516, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_THSD},
+  {601, 616, MB_ACC_R_DISCRETE, _mbLock, IONO_FAULT_THSD},
+  {701, 716, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_ALRM_T1},
+  {801, 816, MB_ACC_R_DISCRETE, _mbFault, IONO_FAULT_ALRM_T2},
+  {2401, 2416, MB_ACC_R_COIL | MB_ACC_R_DISCRETE, _mbDebounced, 0},
+  {3001, 3001, MB_ACC_W_COIL, _mbLed, 0},
+};
+
+static constexpr struct mbRangeStr _mbRegsMap[] = {
+  {MB_REG_CFG_START, MB_REG_CFG_START + MB_REG_CFG_OFFSET_MAX, MB_ACC_R_HOLDING | MB_ACC_W_HOLDING, _mbCfg, 0},
+  {MB_REG_DIAG_START, MB_REG_DIAG_START + MB_DIAG_WORDS - 1, MB_ACC_R_INPUT, _mbDiag, 0},
+  {MB_REG_DIAG_CLR_START, MB_REG_DIAG_CLR_START + MB_DIAG_WORDS - 1, MB_ACC_R_INPUT, _mbDiag, 1},
+  {MB_REG_EV_LOST, MB_REG_EV_LOST, MB_ACC_R_INPUT, _mbEventsLost, 0},
+  {MB_REG_EV_START, MB_REG_EV_START + MB_EV_MAX * MB_EV_WORDS - 1, MB_ACC_R_INPUT | MB_ACC_R_FIFO, _mbEvents, 0},
+  {MB_REG_OUTPUTS, MB_REG_OUTPUTS, MB_ACC_R_HOLDING | MB_ACC_W_HOLDING | MB_ACC_W_MASK, _mbOutputs, 0},
+  {MB_REG_OUTPUTS_STAGED, MB_REG_OUTPUTS_COMMIT, MB_ACC_W_HOLDING, _mbOutputsStaged, 0},
+  {MB_REG_PWM_START, MB_REG_PWM_START + 31, MB_ACC_W_HOLDING, _mbPwm, 0},
+  {MB_REG_STATS_RESET, MB_REG_STATS_RESET, MB_ACC_W_HOLDING, _mbStatsReset, 0},
+  {MB_REG_STATS_START, MB_REG_STATS_START + IONO_PHASE_NUM * MB_STATS_WORDS - 1, MB_ACC_R_INPUT, _mbStats, 0},
+  {2001, 2016, MB_ACC_W_HOLDING, _mbPulse, 0},
+  {2101, 2116, MB_ACC_W_HOLDING, _mbPwmFreq, 0},
+  {2201, 2216, MB_ACC_W_HOLDING, _mbPwmDuty, 0},
+  {2301, 2316, MB_ACC_W_HOLDING, _mbDebounceTime, 0},
+  {2501, 2516, MB_ACC_R_INPUT, _mbCounters, 0},
+  {4001, 4001, MB_ACC_R_INPUT, _mbWgndBits, 0},
+  {4002, 4005, MB_ACC_R_INPUT, _mbWgndData, 0},
+  {4010, 4010, MB_ACC_R_INPUT, _mbWgndNoise, 0},
+  {4100, 4100, MB_ACC_R_INPUT, _mbWgndAvailable, 0},
+  {4101, 4100 + MB_WGND_FRAMES_MAX * MB_WGND_FRAME_WORDS, MB_ACC_R_INPUT, _mbWgndFrames, 0},
+  {5001, 5001, MB_ACC_R_INPUT, _mbWgndBits, 1},
+  {5002, 5005, MB_ACC_R_INPUT, _mbWgndData, 1},
+  {5010, 5010, MB_ACC_R_INPUT, _mbWgndNoise, 1},
+  {5100, 5100, MB_ACC_R_INPUT, _mbWgndAvailable, 1},
+  {5101, 5100 + MB_WGND_FRAMES_MAX * MB_WGND_FRAME_WORDS, MB_ACC_R_INPUT, _mbWgndFrames, 1},
+};
+
+template <int N>
+static constexpr bool _mbMapSorted(const struct mbRangeStr (&map)[N]) {
+  for (int i = 0; i < N; i++) {
+    if (map[i].start > map[i].end || (i > 0 && map[i].start <= map[i - 1].end)) {
+      return false;
+    }
+  }
+  return true;
+}
 
+static_assert(_mbMapSorted(_mbBitsMap), "bits map not sorted");
+static_assert(_mbMapSorted(_mbRegsMap), "registers map not sorted");
+
+static const struct mbRangeStr* _mbRangeFind(const struct mbRangeStr* map, int num, word regAddr, word qty) {
+  int lo = 0;
+  int hi = num - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (regAddr < map[mid].start) {
+      hi = mid - 1;
+    } else if (regAddr > map[mid].end) {
+      lo = mid + 1;
+    } else {
+      return _checkAddrRange(regAddr, qty, map[mid].start, map[mid].end) ? &map[mid] : NULL;
+    }
+  }
+  return NULL;
+}
+
+static byte _mbAccess(byte function) {
+  switch (function) {
+    case MB_FC_READ_COILS:
+      return MB_ACC_R_COIL;
+    case MB_FC_READ_DISCRETE_INPUTS:
+      return MB_ACC_R_DISCRETE;
+    case MB_FC_WRITE_SINGLE_COIL:
+    case MB_FC_WRITE_MULTIPLE_COILS:
+      return MB_ACC_W_COIL;
+    case MB_FC_READ_INPUT_REGISTER:
+      return MB_ACC_R_INPUT;
+    case MB_FC_READ_HOLDING_REGISTERS:
+      return MB_ACC_R_HOLDING;
     case MB_FC_WRITE_SINGLE_REGISTER:
     case MB_FC_WRITE_MULTIPLE_REGISTERS:
-      if (_checkAddrRange(regAddr, qty, 2001, 2016)) {
-        bool ok = true;
-        for (int i = regAddr - 2000; i < regAddr - 2000 + qty; i++) {
-          _doTime[i - 1] = 100 * ModbusRtuSlave.getDataRegister(function, data, i - (regAddr - 2000));
-          if (_doTime[i - 1] > 0) {
-            _doEnabled[i - 1] = true;
-            _doStart[i - 1] = millis();
-            if (!Iono.write(i, HIGH)) {
-              ok = false;
-            }
-          }
-        }
-        return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
-      }
-      if (_checkAddrRange(regAddr, qty, 2101, 2116)) {
-        for (int i = regAddr - 2100; i < regAddr - 2100 + qty; i++) {
-          _pwmFreq[i - 1] = ModbusRtuSlave.getDataRegister(function, data, i - (regAddr - 2100));
-        }
-        return MB_RESP_OK;
-      }
-      if (_checkAddrRange(regAddr, qty, 2201, 2216)) {
-        bool ok = true;
-        for (int i = regAddr - 2200; i < regAddr - 2200 + qty; i++) {
-          word duty = ModbusRtuSlave.getDataRegister(function, data, i - (regAddr - 2200));
-          if (!Iono.pwmSet(i, _pwmFreq[i - 1], duty)) {
-            ok = false;
-          }
-        }
-        return ok ? MB_RESP_OK : MB_EX_ILLEGAL_FUNCTION;
-      }
-      if (_checkAddrRange(regAddr, qty, 2301, 2316)) {
-        for (int i = regAddr - 2300; i < regAddr - 2300 + qty; i++) {
-          word deb = ModbusRtuSlave.getDataRegister(function, data, i - (regAddr - 2300));
-          if (deb > 0) {
-            Iono.subscribe(i, deb, _debounceCb);
-          } else {
-            Iono.subscribe(i, 0, NULL);
-          }
-        }
-        return MB_RESP_OK;
-      }
-      if (_checkAddrRange(regAddr, qty, MB_REG_CFG_START, MB_REG_CFG_START + MB_REG_CFG_OFFSET_MAX)) {
-        int offset = regAddr - MB_REG_CFG_START;
-        int offsetEnd = offset + qty;
-        bool commit = false;
-
-        for (int i = offset; i < offsetEnd; i++) {
-          word val = ModbusRtuSlave.getDataRegister(function, data, i - offset);
-          if (i == MB_REG_CFG_OFFSET_COMMIT) {
-            if (qty != 1 || val != CFG_COMMIT_VAL) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-            commit = true;
-          } else if (i == MB_REG_CFG_OFFSET_MB_ADDR) {
-            if (val < 1 || val > 247) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          } else if (i == MB_REG_CFG_OFFSET_MB_BAUD) {
-            if (val < 1 || val > 8) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          } else if (i == MB_REG_CFG_OFFSET_MB_PARITY) {
-            if (val < 1 || val > 3) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          } else if (i >= MB_REG_CFG_OFFSET_MODE_D1 && i <= MB_REG_CFG_OFFSET_MODE_D16) {
-            if (val < 1 || val > 6) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          } else if (i >= MB_REG_CFG_OFFSET_LINK_D1 && i <= MB_REG_CFG_OFFSET_LINK_D16) {
-            if (val < 0 || val > 16) {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          } else if (i >= MB_REG_CFG_OFFSET_RULE_D1 && i <= MB_REG_CFG_OFFSET_RULE_D16) {
-            if (val != 'F' && val != 'I' && val != 'H' && val != 'L' && val != 'T') {
-              return MB_EX_ILLEGAL_DATA_VALUE;
-            }
-          }
-          _cfgRegisters[i] = val;
-        }
-
-        if (commit) {
-          configCommit(_cfgRegisters, MB_REG_CFG_OFFSET_MAX + 1);
-        }
-
-        return MB_RESP_OK;
-      }
-      return MB_EX_ILLEGAL_DATA_ADDRESS;
-
+      return MB_ACC_W_HOLDING;
+    case MB_FC_MASK_WRITE_REGISTER:
+      return MB_ACC_W_MASK;
+    case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+      return MB_ACC_R_HOLDING;
+    case MB_FC_READ_FIFO_QUEUE:
+      return MB_ACC_R_FIFO;
     default:
-      return MB_EX_ILLEGAL_FUNCTION;
+      return 0;
+  }
+}
+
+static const struct mbRangeStr* _mbRegsRangeFind(word regAddr, word qty, byte access) {
+  const struct mbRangeStr* r;
+  r = _mbRangeFind(_mbRegsMap, sizeof(_mbRegsMap) / sizeof(_mbRegsMap[0]), regAddr, qty);
+  if (r == NULL || (r->access & access) == 0) {
+    return NULL;
+  }
+  return r;
+}
+
+static byte _mbReadWrite(word regAddr, word qty, byte *data) {
+  // The write is performed before the read, both are validated before
+  // writing anything. The write quantity has been checked against the
+  // byte count by rtu.h
+  const struct mbRangeStr* rr;
+  const struct mbRangeStr* rw;
+  word wrAddr = (data[0] << 8) | data[1];
+  word wrQty = (data[2] << 8) | data[3];
+  byte res;
+  rr = _mbRegsRangeFind(regAddr, qty, MB_ACC_R_HOLDING);
+  rw = _mbRegsRangeFind(wrAddr, wrQty, MB_ACC_W_HOLDING);
+  if (rr == NULL || rw == NULL) {
+    return MB_EX_ILLEGAL_DATA_ADDRESS;
+  }
+  res = rw->handler(MB_FC_READ_WRITE_MULTIPLE_REGISTERS, wrAddr - rw->start, wrQty, data, rw->arg);
+  if (res != MB_RESP_OK) {
+    return res;
+  }
+  return rr->handler(MB_FC_READ_HOLDING_REGISTERS, regAddr - rr->start, qty, data, rr->arg);
+}
+
+static byte _modbusOnRequest(byte unitAddr, byte function, word regAddr, word qty, byte *data) {
+  const struct mbRangeStr* r;
+  byte access = _mbAccess(function);
+  _eventsServed = 0;
+  if (access == 0) {
+    return MB_EX_ILLEGAL_FUNCTION;
+  }
+  if (unitAddr == 0 && access != MB_ACC_W_COIL && access != MB_ACC_W_HOLDING && access != MB_ACC_W_MASK) {
+    // broadcast requests get no response
+    return MB_EX_ILLEGAL_FUNCTION;
+  }
+  if (function == MB_FC_READ_WRITE_MULTIPLE_REGISTERS) {
+    return _mbReadWrite(regAddr, qty, data);
+  }
+  if ((access & MB_ACC_BITS) != 0) {
+    r = _mbRangeFind(_mbBitsMap, sizeof(_mbBitsMap) / sizeof(_mbBitsMap[0]), regAddr, qty);
+    if (r != NULL && (r->access & access) == 0) {
+      r = NULL;
+    }
+  } else if (function == MB_FC_MASK_WRITE_REGISTER || function == MB_FC_READ_FIFO_QUEUE) {
+    // the request carries a single address, qty has a different meaning
+    r = _mbRegsRangeFind(regAddr, 1, access);
+  } else {
+    r = _mbRegsRangeFind(regAddr, qty, access);
+  }
+  if (r == NULL) {
+    return MB_EX_ILLEGAL_DATA_ADDRESS;
+  }
+  return r->handler(function, regAddr - r->start, qty, data, r->arg);
+}
+
+static void _modbusOnSent(byte function) {
+  if (_eventsServed > 0) {
+    _eventsNum -= _eventsServed;
+    memmove(_events, _events + _eventsServed, _eventsNum * sizeof(IonoD16Event));
+    _eventsServed = 0;
   }
 }
 
@@ -368,15 +725,40 @@ void modbusBegin(byte unitAddr, uint16_t baudIdx, uint16_t parity) {
     case 8:
       baud = 115200;
       break;
+    case 9:
+      baud = 230400;
+      break;
     default:
       baud = 9600;
   }
 
+  // Room for a whole RTU frame, so that a request is not lost if the
+  // loop is late at the highest baud rates
+  IONO_RS485.setFIFOSize(RTU_FRAME_MAX);
+
   IONO_RS485.begin(baud, serCfg);
-  ModbusRtuSlave.setCallback(&_modbusOnRequest);
-  ModbusRtuSlave.begin(unitAddr, &IONO_RS485, baud, IONO_PIN_RS485_TXEN_N, true);
+  rtuBegin(unitAddr, &IONO_RS485, baud, &_modbusOnRequest);
+  rtuSetSentCallback(&_modbusOnSent);
+}
+
+// To be called with the result of Iono.configure(): the output word
+// only covers the pins actually in output mode
+void modbusConfigured(bool ok) {
+  _outputsMask = 0;
+  for (int d = D1; d <= D16; d++) {
+    int mode = Iono.pinModeRead(d);
+    if (mode == OUTPUT_HS || mode == OUTPUT_PP) {
+      _outputsMask |= 1 << (d - D1);
+    }
+  }
+  _configError = !ok;
 }
 
 void modbusProcess() {
-  ModbusRtuSlave.process();
+  rtuProcess();
+
+  if (_outputsApplyPending && (long) (micros() - _outputsApplyTs) >= 0) {
+    _outputsApplyPending = false;
+    Iono.writeMask(_outputsMask, _outputsStaged);
+  }
 }
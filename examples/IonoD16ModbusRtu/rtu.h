@@ -0,0 +1,334 @@
+/*
+ * rtu.h - Modbus RTU slave framing for the IonoD16ModbusRtu sketch
+ *
+ *   Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+ *
+ *   For information, see:
+ *   http://www.sferalabs.cc/
+ *
+ * This code is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * See file LICENSE.txt for further informations on licensing terms.
+ *
+ */
+
+#define MB_FC_READ_COILS                     1
+#define MB_FC_READ_DISCRETE_INPUTS           2
+#define MB_FC_READ_HOLDING_REGISTERS         3
+#define MB_FC_READ_INPUT_REGISTER            4
+#define MB_FC_WRITE_SINGLE_COIL              5
+#define MB_FC_WRITE_SINGLE_REGISTER          6
+#define MB_FC_WRITE_MULTIPLE_COILS           15
+#define MB_FC_WRITE_MULTIPLE_REGISTERS       16
+#define MB_FC_MASK_WRITE_REGISTER            22
+#define MB_FC_READ_WRITE_MULTIPLE_REGISTERS  23
+#define MB_FC_READ_FIFO_QUEUE                24
+
+#define MB_RESP_OK                           0x00
+#define MB_EX_ILLEGAL_FUNCTION               0x01
+#define MB_EX_ILLEGAL_DATA_ADDRESS           0x02
+#define MB_EX_ILLEGAL_DATA_VALUE             0x03
+#define MB_EX_SERVER_DEVICE_FAILURE          0x04
+
+#define RTU_FRAME_MAX                        256
+#define RTU_FIFO_COUNT_MAX                   31
+
+// Requests are parsed here and passed to the callback as below, after
+// checking the PDU length, the quantities against the limits of the
+// function and the byte counts against the quantities (exception 3
+// otherwise):
+// - FC 1, 2, 3, 4: regAddr, qty, data = NULL
+// - FC 5, 6: regAddr, qty = 1, data = the value
+// - FC 15, 16: regAddr, qty, data = the values
+// - FC 22: regAddr, qty = 1, data = AND mask, OR mask
+// - FC 23: regAddr and qty of the read part, data = write address,
+//   write quantity, byte count, values
+// - FC 24: regAddr = FIFO pointer address, qty = 0, data = NULL
+// Other function codes are answered with exception 1.
+// The values are got with rtuDataCoil() and rtuDataRegister(), the
+// response data is added with rtuResponseAddBit() and
+// rtuResponseAddRegister(); the byte count, the FIFO count and the echo
+// of the write requests are added here. Broadcast requests (unit 0) are
+// passed to the callback and get no response.
+// The optional sent callback is called once a positive response has
+// been transmitted
+typedef byte (*rtuCallback)(byte unitAddr, byte function, word regAddr, word qty, byte *data);
+typedef void (*rtuSentCallback)(byte function);
+
+static SerialUART* _rtuSerial;
+static byte _rtuUnitAddr;
+static rtuCallback _rtuCallback;
+static rtuSentCallback _rtuSentCallback;
+static unsigned long _rtuT35Us;
+
+static byte _rtuReq[RTU_FRAME_MAX];
+static size_t _rtuReqLen;
+static unsigned long _rtuReqTs;
+
+static byte _rtuResp[RTU_FRAME_MAX];
+static size_t _rtuRespLen;
+static int _rtuRespBits;
+
+static word rtuCrc(const byte *buf, size_t len) {
+  word crc = 0xffff;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+    }
+  }
+  return crc;
+}
+
+static word _rtuWord(const byte *buf) {
+  return (buf[0] << 8) | buf[1];
+}
+
+static bool rtuDataCoil(byte function, byte *data, word idx) {
+  if (function == MB_FC_WRITE_SINGLE_COIL) {
+    return data[0] == 0xff;
+  }
+  return (data[idx / 8] >> (idx % 8)) & 1;
+}
+
+static word rtuDataRegister(byte function, byte *data, word idx) {
+  if (function == MB_FC_READ_WRITE_MULTIPLE_REGISTERS) {
+    return _rtuWord(data + 5 + idx * 2);
+  }
+  return _rtuWord(data + idx * 2);
+}
+
+static bool rtuResponseAddBit(bool on) {
+  if (_rtuRespBits % 8 == 0) {
+    if (_rtuRespLen + 1 > RTU_FRAME_MAX - 2) {
+      return false;
+    }
+    _rtuResp[_rtuRespLen++] = 0;
+  }
+  if (on) {
+    _rtuResp[_rtuRespLen - 1] |= 1 << (_rtuRespBits % 8);
+  }
+  _rtuRespBits++;
+  return true;
+}
+
+static bool rtuResponseAddRegister(word value) {
+  if (_rtuRespLen + 2 > RTU_FRAME_MAX - 2) {
+    return false;
+  }
+  _rtuResp[_rtuRespLen++] = value >> 8;
+  _rtuResp[_rtuRespLen++] = value & 0xff;
+  return true;
+}
+
+static byte _rtuParse(byte function, byte *pdu, size_t len, word *regAddr, word *qty, byte **data) {
+  *regAddr = len >= 2 ? _rtuWord(pdu) : 0;
+  *qty = len >= 4 ? _rtuWord(pdu + 2) : 0;
+  *data = NULL;
+  switch (function) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUTS:
+      return len == 4 && *qty >= 1 && *qty <= 2000 ? MB_RESP_OK : MB_EX_ILLEGAL_DATA_VALUE;
+    case MB_FC_READ_HOLDING_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+      return len == 4 && *qty >= 1 && *qty <= 125 ? MB_RESP_OK : MB_EX_ILLEGAL_DATA_VALUE;
+    case MB_FC_WRITE_SINGLE_COIL:
+      if (len != 4 || (*qty != 0xff00 && *qty != 0x0000)) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *qty = 1;
+      *data = pdu + 2;
+      return MB_RESP_OK;
+    case MB_FC_WRITE_SINGLE_REGISTER:
+      if (len != 4) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *qty = 1;
+      *data = pdu + 2;
+      return MB_RESP_OK;
+    case MB_FC_WRITE_MULTIPLE_COILS:
+      if (len < 5 || *qty < 1 || *qty > 1968 || pdu[4] != (*qty + 7) / 8 || len != 5u + pdu[4]) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *data = pdu + 5;
+      return MB_RESP_OK;
+    case MB_FC_WRITE_MULTIPLE_REGISTERS:
+      if (len < 5 || *qty < 1 || *qty > 123 || pdu[4] != *qty * 2 || len != 5u + pdu[4]) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *data = pdu + 5;
+      return MB_RESP_OK;
+    case MB_FC_MASK_WRITE_REGISTER:
+      if (len != 6) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *qty = 1;
+      *data = pdu + 2;
+      return MB_RESP_OK;
+    case MB_FC_READ_WRITE_MULTIPLE_REGISTERS: {
+      if (len < 9) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      word wrQty = _rtuWord(pdu + 6);
+      if (*qty < 1 || *qty > 125 || wrQty < 1 || wrQty > 121 || pdu[8] != wrQty * 2 || len != 9u + pdu[8]) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *data = pdu + 4;
+      return MB_RESP_OK;
+    }
+    case MB_FC_READ_FIFO_QUEUE:
+      if (len != 2) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      *qty = 0;
+      return MB_RESP_OK;
+    default:
+      return MB_EX_ILLEGAL_FUNCTION;
+  }
+}
+
+// Length of the response before the data added by the callback
+static size_t _rtuRespHeaderLen(byte function) {
+  switch (function) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUTS:
+    case MB_FC_READ_HOLDING_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+    case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+      return 3;
+    case MB_FC_READ_FIFO_QUEUE:
+      return 6;
+    default:
+      return 2;
+  }
+}
+
+static byte _rtuRespComplete(byte function, byte *pdu, word qty) {
+  size_t n = _rtuRespLen - _rtuRespHeaderLen(function);
+  switch (function) {
+    case MB_FC_READ_COILS:
+    case MB_FC_READ_DISCRETE_INPUTS:
+      if (n != (qty + 7u) / 8) {
+        return MB_EX_SERVER_DEVICE_FAILURE;
+      }
+      _rtuResp[2] = n;
+      return MB_RESP_OK;
+    case MB_FC_READ_HOLDING_REGISTERS:
+    case MB_FC_READ_INPUT_REGISTER:
+    case MB_FC_READ_WRITE_MULTIPLE_REGISTERS:
+      if (n != qty * 2u) {
+        return MB_EX_SERVER_DEVICE_FAILURE;
+      }
+      _rtuResp[2] = n;
+      return MB_RESP_OK;
+    case MB_FC_READ_FIFO_QUEUE:
+      if (n / 2 > RTU_FIFO_COUNT_MAX) {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+      }
+      _rtuResp[2] = 0;
+      _rtuResp[3] = n + 2;
+      _rtuResp[4] = 0;
+      _rtuResp[5] = n / 2;
+      return MB_RESP_OK;
+    case MB_FC_MASK_WRITE_REGISTER:
+      memcpy(_rtuResp + 2, pdu, 6);
+      _rtuRespLen = 8;
+      return MB_RESP_OK;
+    default:
+      // FC 5, 6: echo of the request, FC 15, 16: address and quantity
+      memcpy(_rtuResp + 2, pdu, 4);
+      _rtuRespLen = 6;
+      return MB_RESP_OK;
+  }
+}
+
+static void _rtuSend() {
+  word crc = rtuCrc(_rtuResp, _rtuRespLen);
+  _rtuResp[_rtuRespLen++] = crc & 0xff;
+  _rtuResp[_rtuRespLen++] = crc >> 8;
+  Iono.rs485TxEn(true);
+  _rtuSerial->write(_rtuResp, _rtuRespLen);
+  // returns when the last stop bit is out
+  _rtuSerial->flush();
+  Iono.rs485TxEn(false);
+}
+
+static void _rtuFrame(byte *req, size_t len) {
+  word regAddr = 0;
+  word qty = 0;
+  byte *data = NULL;
+  byte res;
+
+  if (len < 4 || rtuCrc(req, len - 2) != (req[len - 2] | (req[len - 1] << 8))) {
+    return;
+  }
+  byte unitAddr = req[0];
+  if (unitAddr != _rtuUnitAddr && unitAddr != 0) {
+    return;
+  }
+  byte function = req[1];
+  byte *pdu = req + 2;
+
+  _rtuResp[0] = unitAddr;
+  _rtuResp[1] = function;
+  _rtuRespLen = _rtuRespHeaderLen(function);
+  _rtuRespBits = 0;
+  res = _rtuParse(function, pdu, len - 4, &regAddr, &qty, &data);
+  if (res == MB_RESP_OK) {
+    res = _rtuCallback(unitAddr, function, regAddr, qty, data);
+  }
+  if (unitAddr == 0) {
+    return;
+  }
+  if (res == MB_RESP_OK) {
+    res = _rtuRespComplete(function, pdu, qty);
+  }
+  if (res != MB_RESP_OK) {
+    _rtuResp[1] = function | 0x80;
+    _rtuResp[2] = res;
+    _rtuRespLen = 3;
+  }
+  _rtuSend();
+  if (res == MB_RESP_OK && _rtuSentCallback != NULL) {
+    _rtuSentCallback(function);
+  }
+}
+
+static void rtuBegin(byte unitAddr, SerialUART* serial, unsigned long baud, rtuCallback callback) {
+  _rtuSerial = serial;
+  _rtuUnitAddr = unitAddr;
+  _rtuCallback = callback;
+  // 3.5 characters of 11 bits, fixed above 19200 bit/s
+  _rtuT35Us = baud > 19200 ? 1750 : 38500000ul / baud;
+  _rtuReqLen = 0;
+}
+
+static void rtuSetSentCallback(rtuSentCallback callback) {
+  _rtuSentCallback = callback;
+}
+
+// A frame ends when no byte is received for 3.5 characters. The bytes
+// are time-stamped when read, so the 1.5 characters limit between the
+// bytes of a frame is not checked: a late loop would make it discard
+// valid frames. Frames longer than RTU_FRAME_MAX are dropped
+static void rtuProcess() {
+  while (_rtuSerial->available() > 0) {
+    int b = _rtuSerial->read();
+    if (_rtuReqLen < RTU_FRAME_MAX) {
+      _rtuReq[_rtuReqLen] = b;
+    }
+    if (_rtuReqLen <= RTU_FRAME_MAX) {
+      _rtuReqLen++;
+    }
+    _rtuReqTs = micros();
+  }
+  if (_rtuReqLen == 0 || micros() - _rtuReqTs < _rtuT35Us) {
+    return;
+  }
+  if (_rtuReqLen <= RTU_FRAME_MAX) {
+    _rtuFrame(_rtuReq, _rtuReqLen);
+  }
+  _rtuReqLen = 0;
+}
@@ -15,10 +15,9 @@
  */
  
 #include <IonoD16.h>
-#include <Wiegand.h>
 
+// D0 on DT1 and D1 on DT2, or D0 on DT3 and D1 on DT4
 #define PIN_D0 DT1
-#define PIN_D1 DT2
 
 void setup1() {
   Iono.setup();
@@ -26,35 +25,25 @@ void setup1() {
 
 void loop1() {
   Iono.process();
-  delay(1);
+  // wake up at the next soft-PWM edge, at least every millisecond
+  unsigned long next = Iono.pwmNextUs();
+  delayMicroseconds(next < 1000 ? next : 1000);
 }
 
-Wiegand w(PIN_D0, PIN_D1);
-
 uint64_t data;
 int bits;
 int noise;
 
 char buff[20];
 
-void onData0() {
-  w.onData0();
-}
-
-void onData1() {
-  w.onData1();
-}
-
 void setup() {
   Serial.begin(9600);
   while(!Serial);
   
   while (!Iono.ready()) ;
 
-  w.setup(
-    onData0,
-    onData1,
-    false,  // disable pins internal pull-up, use external
+  Iono.wiegandSetup(
+    PIN_D0,
     700,    // min pulse interval (usec)
     2700,   // max pulse interval (usec)
     10,     // min pulse width (usec)
@@ -65,8 +54,8 @@ void setup() {
 }
 
 void loop() {
-  bits = w.getData(&data);
-  noise = w.getNoise();
+  bits = Iono.wiegandRead(PIN_D0, &data, NULL);
+  noise = Iono.wiegandNoise(PIN_D0);
 
   if (bits > 0) {
     Serial.print("Bits: ");
@@ -0,0 +1,184 @@
+/*
+  bench.cpp - process() cycle cost on the simulated board
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+// Runs process() every millisecond on representative configurations
+// and reports, per cycle, the SPI frames and bytes, the bus time at
+// the configured SCLK and the host CPU time, with percentiles, then
+// the per-phase times measured by stats().
+//
+// Usage: bench [cycles] [scenario]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "IonoD16.h"
+#include "IonoSim.h"
+
+#define BENCH_CYCLE_US 1000
+
+static const char* _phases[IONO_PHASE_NUM] = {
+  "inputs", "diag", "link", "pwm", "led", "cycle"
+};
+
+static void _setupInputs() {
+  for (int p = D1; p <= D16; p++) {
+    Iono.pinMode(p, INPUT);
+  }
+}
+
+static void _setupOutputs() {
+  for (int p = D1; p <= D16; p++) {
+    Iono.pinMode(p, OUTPUT_HS);
+  }
+}
+
+static void _setupLinks() {
+  for (int p = D1; p <= D8; p++) {
+    Iono.pinMode(p, INPUT);
+    Iono.pinMode(p + 8, OUTPUT_HS);
+    Iono.link(p, p + 8, LINK_FOLLOW, 0);
+    Iono.link(p, p + 8, LINK_FLIP_T, 0);
+  }
+}
+
+static void _setupPwm() {
+  for (int p = D1; p <= D16; p++) {
+    Iono.pinMode(p, OUTPUT_PP);
+    Iono.pwmSet(p, 10 + p, 32768);
+  }
+}
+
+static void _toggleInputs(int n) {
+  for (int p = D1; p <= D8; p++) {
+    IonoSim::inputWrite(p, (n >> (p - D1)) & 1);
+  }
+}
+
+static void _toggleOutputs(int n) {
+  Iono.writeMask(0xffff, n * 0x0101);
+}
+
+static struct {
+  const char* name;
+  void (*setup)();
+  void (*activity)(int);
+} _scenarios[] = {
+  {"inputs", _setupInputs, _toggleInputs},
+  {"outputs", _setupOutputs, _toggleOutputs},
+  {"links", _setupLinks, _toggleInputs},
+  {"pwm", _setupPwm, NULL},
+};
+
+static uint64_t _hostNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned long _totalFrames() {
+  unsigned long n = 0;
+  for (int i = 0; i < 2; i++) {
+    n += IonoSim::max22190[i].frames + IonoSim::max14912[i].frames;
+  }
+  return n;
+}
+
+template<class T> static T _pct(std::vector<T>& v, int p) {
+  size_t i = (v.size() - 1) * p / 100;
+  std::nth_element(v.begin(), v.begin() + i, v.end());
+  return v[i];
+}
+
+template<class T> static void _report(const char* what, std::vector<T>& v) {
+  printf("  %-14s p50 %8lu  p90 %8lu  p99 %8lu  max %8lu\n", what,
+      (unsigned long) _pct(v, 50), (unsigned long) _pct(v, 90),
+      (unsigned long) _pct(v, 99), (unsigned long) *std::max_element(v.begin(), v.end()));
+}
+
+static void _run(int s, int cycles) {
+  std::vector<unsigned long> frames;
+  std::vector<unsigned long> busUs;
+  std::vector<unsigned long> hostNs;
+
+  _scenarios[s].setup();
+  for (int i = 0; i < 100; i++) {
+    Iono.process();
+    IonoSim::advanceUs(BENCH_CYCLE_US);
+  }
+  Iono.statsReset();
+
+  for (int i = 0; i < cycles; i++) {
+    if (i % 50 == 0 && _scenarios[s].activity != NULL) {
+      _scenarios[s].activity(i / 50);
+    }
+    unsigned long f = _totalFrames();
+    unsigned long ts = IonoSim::nowUs();
+    uint64_t ns = _hostNs();
+    IonoSim::spiTiming(true);
+    Iono.process();
+    IonoSim::spiTiming(false);
+    hostNs.push_back(_hostNs() - ns);
+    busUs.push_back(IonoSim::nowUs() - ts);
+    frames.push_back(_totalFrames() - f);
+    IonoSim::advanceUs(BENCH_CYCLE_US - busUs.back() % BENCH_CYCLE_US);
+  }
+
+  unsigned long total = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    total += frames[i];
+  }
+  printf("%s: %d cycles, %lu frames, %lu bytes\n", _scenarios[s].name,
+      cycles, total, total * 3);
+  _report("frames/cycle", frames);
+  _report("bus us/cycle", busUs);
+  _report("host ns/cycle", hostNs);
+
+  IonoD16PhaseStats st[IONO_PHASE_NUM];
+  if (Iono.stats(st)) {
+    for (int p = 0; p < IONO_PHASE_NUM; p++) {
+      printf("  phase %-8s count %8lu  min %6lu  avg %6lu  max %6lu us\n",
+          _phases[p], (unsigned long) st[p].count, (unsigned long) st[p].minUs,
+          (unsigned long) st[p].avgUs, (unsigned long) st[p].maxUs);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int cycles = argc > 1 ? atoi(argv[1]) : 10000;
+  const char* only = argc > 2 ? argv[2] : NULL;
+
+  // each scenario runs in a child process, on a freshly set up board
+  for (size_t s = 0; s < sizeof(_scenarios) / sizeof(_scenarios[0]); s++) {
+    if (only != NULL && strcmp(only, _scenarios[s].name) != 0) {
+      continue;
+    }
+    char cmd[256];
+    if (only == NULL) {
+      snprintf(cmd, sizeof(cmd), "\"%s\" %d %s", argv[0], cycles, _scenarios[s].name);
+      if (system(cmd) != 0) {
+        return 1;
+      }
+      continue;
+    }
+    if (!Iono.setup()) {
+      return 1;
+    }
+    _run(s, cycles);
+  }
+  return 0;
+}
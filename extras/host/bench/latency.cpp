@@ -0,0 +1,70 @@
+/*
+  latency.cpp - Modbus example, request to response latency on a
+  loopback virtual bus at each baud rate
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <stdlib.h>
+#include <algorithm>
+#include "modbus.h"
+#include "test.h"
+
+#define STEP_US 5
+#define REQUESTS 100
+
+static const unsigned long _bauds[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400};
+
+int main(int argc, char** argv) {
+  unsigned long loopUs = argc > 1 ? atol(argv[1]) : 100;
+
+  mbStart(NULL);
+  printf("loop() period %lu us, FC3 request of 1 register (8 bytes), response 7 bytes\n", loopUs);
+  printf("%8s %6s %6s %8s %8s %8s %8s\n", "baud", "t3.5", "frame", "turn-p50", "turn-max", "rtt-p50", "rtt-max");
+  for (int idx = 1; idx <= 9; idx++) {
+    unsigned long baud = _bauds[idx - 1];
+    unsigned long charUs = 11000000ul / baud;
+    std::vector<long> turn;
+    modbusBegin(MB_TEST_UNIT, idx, 1);
+    std::vector<struct mbBusFrameStr> frames = {
+      {0, mbFrame(MB_TEST_UNIT, MB_FC_READ_HOLDING_REGISTERS, mbWords({MB_REG_CFG_START + MB_REG_CFG_OFFSET_MB_ADDR, 1}))},
+    };
+    unsigned long reqUs = frames[0].bytes.size() * charUs;
+    for (int k = 0; k < REQUESTS; k++) {
+      IONO_RS485.tx.clear();
+      // request at a different point of the loop() period each time
+      long t = mbBusRun(frames, baud, loopUs, (k * 37) % loopUs, STEP_US, reqUs + 100000,
+          [](unsigned long t) { return !IONO_RS485.tx.empty(); });
+      CHECK(t >= 0);
+      CHECK(mbResponse(MB_TEST_UNIT) == Pdu({MB_FC_READ_HOLDING_REGISTERS, 2, 0, MB_TEST_UNIT}));
+      if (t < 0) {
+        continue;
+      }
+      // from the end of the request to the start of the response
+      turn.push_back(t - reqUs);
+      CHECK(t - (long) reqUs >= (long) _rtuT35Us);
+      CHECK(t - (long) reqUs <= (long) (_rtuT35Us + 2 * loopUs + 2 * STEP_US));
+      CHECK(IonoSim::pins[IONO_PIN_RS485_TXEN_N] == HIGH);
+    }
+    if (turn.empty()) {
+      continue;
+    }
+    std::sort(turn.begin(), turn.end());
+    long p50 = turn[turn.size() / 2];
+    long max = turn.back();
+    unsigned long respUs = 7 * charUs;
+    printf("%8lu %6lu %6lu %8ld %8ld %8ld %8ld\n", baud, _rtuT35Us, reqUs, p50, max,
+        reqUs + p50 + respUs, reqUs + max + respUs);
+  }
+
+  TEST_END();
+}
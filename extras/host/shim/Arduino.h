@@ -0,0 +1,125 @@
+/*
+  Arduino.h - Host build shim of the arduino-pico core
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define HEX 16
+
+#define SERIAL_8N1 0
+#define SERIAL_8E1 1
+#define SERIAL_8O1 2
+#define SERIAL_8N2 3
+
+// Time and pins are provided by the simulated board, see IonoSim.h
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int val);
+int digitalRead(int pin);
+
+// pico/mutex.h, a single thread runs both "cores" on the host
+typedef struct {
+  bool owned;
+} mutex_t;
+
+inline void mutex_init(mutex_t* m) {
+  m->owned = false;
+}
+
+inline void mutex_enter_blocking(mutex_t* m) {
+  m->owned = true;
+}
+
+inline bool mutex_try_enter(mutex_t* m, uint32_t* owner) {
+  if (m->owned) {
+    return false;
+  }
+  m->owned = true;
+  return true;
+}
+
+inline void mutex_exit(mutex_t* m) {
+  m->owned = false;
+}
+
+// Received bytes are queued by the test in rx, sent ones collected in tx
+class SerialUART {
+  public:
+    void begin(unsigned long baud, uint16_t config = SERIAL_8N1) {
+      _baud = baud;
+    }
+    void end() {}
+    bool setRX(int) { return true; }
+    bool setTX(int) { return true; }
+    bool setFIFOSize(size_t size) {
+      _fifoSize = size;
+      return true;
+    }
+    template<class T> size_t print(T) { return 0; }
+    template<class T> size_t print(T, int) { return 0; }
+    template<class T> size_t println(T) { return 0; }
+    template<class T> size_t println(T, int) { return 0; }
+    size_t println() { return 0; }
+    void flush() {}
+    int available() {
+      return rx.size();
+    }
+    int read() {
+      if (rx.empty()) {
+        return -1;
+      }
+      int b = rx.front();
+      rx.erase(rx.begin());
+      return b;
+    }
+    size_t write(uint8_t b) {
+      tx.push_back(b);
+      return 1;
+    }
+    size_t write(const uint8_t* buf, size_t n) {
+      tx.insert(tx.end(), buf, buf + n);
+      return n;
+    }
+    operator bool() { return true; }
+
+    unsigned long _baud;
+    size_t _fifoSize;
+    std::vector<uint8_t> rx;
+    std::vector<uint8_t> tx;
+};
+
+extern SerialUART Serial;
+extern SerialUART Serial1;
+
+#endif
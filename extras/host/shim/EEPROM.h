@@ -0,0 +1,41 @@
+/*
+  EEPROM.h - Host build shim of the arduino-pico core
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include <Arduino.h>
+
+#define IONO_SIM_EEPROM_SIZE 4096
+
+class EEPROMClass {
+  public:
+    void begin(size_t size) {}
+    uint8_t read(int addr) {
+      return data[addr];
+    }
+    void write(int addr, uint8_t val) {
+      data[addr] = val;
+    }
+    bool commit() {
+      return true;
+    }
+
+    uint8_t data[IONO_SIM_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
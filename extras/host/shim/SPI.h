@@ -0,0 +1,46 @@
+/*
+  SPI.h - Host build shim of the arduino-pico core
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef SPI_h
+#define SPI_h
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+    SPISettings() : clock(0) {}
+    SPISettings(uint32_t clockHz, int bitOrder, int dataMode) : clock(clockHz) {}
+    uint32_t clock;
+};
+
+// Bytes are exchanged with the chip models of the simulated board
+class SPIClassRP2040 {
+  public:
+    bool setRX(int) { return true; }
+    bool setTX(int) { return true; }
+    bool setSCK(int) { return true; }
+    void begin() {}
+    void end() {}
+    void beginTransaction(SPISettings settings);
+    void endTransaction() {}
+    uint8_t transfer(uint8_t data);
+};
+
+extern SPIClassRP2040 SPI;
+
+#endif
@@ -0,0 +1,28 @@
+/*
+  Wire.h - Host build shim of the arduino-pico core
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef Wire_h
+#define Wire_h
+
+class TwoWire {
+  public:
+    bool setSDA(int) { return true; }
+    bool setSCL(int) { return true; }
+    void begin() {}
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  hardware/clocks.h - Host build shim of the Raspberry Pi Pico SDK
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef _HARDWARE_CLOCKS_H
+#define _HARDWARE_CLOCKS_H
+
+#include <stdint.h>
+
+enum clock_index {
+  clk_sys = 5
+};
+
+#define IONO_SIM_CLK_SYS_HZ 125000000
+
+inline uint32_t clock_get_hz(enum clock_index clk) {
+  return IONO_SIM_CLK_SYS_HZ;
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+  hardware/pio.h - Host build shim of the Raspberry Pi Pico SDK
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef _HARDWARE_PIO_H
+#define _HARDWARE_PIO_H
+
+#include <stdint.h>
+
+// The state machines are executed by the PIO model of the simulated
+// board, see IonoSim::pioStep()
+
+typedef unsigned int uint;
+
+#define PIO_FDEBUG_RXSTALL_LSB 0
+
+// FDEBUG, set by the PIO model, bits written as 1 are cleared as on the
+// hardware
+struct pio_fdebug_reg {
+  uint32_t bits;
+  operator uint32_t() const { return bits; }
+  pio_fdebug_reg& operator=(uint32_t clear) {
+    bits &= ~clear;
+    return *this;
+  }
+};
+
+// Only FDEBUG is modelled, a PIO block is identified by address
+typedef struct pio_hw {
+  pio_fdebug_reg fdebug;
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+
+extern PIO pio0;
+extern PIO pio1;
+
+typedef struct pio_program {
+  const uint16_t* instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+
+typedef struct {
+  uint wrapTarget;
+  uint wrap;
+  uint inBase;
+  uint jmpPin;
+  bool fifoJoinRx;
+  float clkdiv;
+} pio_sm_config;
+
+enum pio_fifo_join {
+  PIO_FIFO_JOIN_NONE = 0,
+  PIO_FIFO_JOIN_TX = 1,
+  PIO_FIFO_JOIN_RX = 2
+};
+
+enum pio_src_dest {
+  pio_pins = 0,
+  pio_x = 1,
+  pio_y = 2,
+  pio_null = 3,
+  pio_pindirs = 4,
+  pio_exec_mov = 4,
+  pio_status = 5,
+  pio_pc = 5,
+  pio_isr = 6,
+  pio_osr = 7,
+  pio_exec_out = 7
+};
+
+bool pio_can_add_program(PIO pio, const pio_program_t* program);
+uint pio_add_program(PIO pio, const pio_program_t* program);
+int pio_claim_unused_sm(PIO pio, bool required);
+
+pio_sm_config pio_get_default_sm_config();
+void sm_config_set_wrap(pio_sm_config* c, uint wrapTarget, uint wrap);
+void sm_config_set_in_pins(pio_sm_config* c, uint inBase);
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin);
+void sm_config_set_fifo_join(pio_sm_config* c, enum pio_fifo_join join);
+void sm_config_set_clkdiv(pio_sm_config* c, float div);
+inline void sm_config_set_in_shift(pio_sm_config* c, bool shiftRight, bool autopush, uint threshold) {}
+inline void sm_config_set_out_shift(pio_sm_config* c, bool shiftRight, bool autopull, uint threshold) {}
+
+inline void pio_sm_set_consecutive_pindirs(PIO pio, uint sm, uint pin, uint count, bool isOut) {}
+void pio_sm_init(PIO pio, uint sm, uint initialPc, const pio_sm_config* config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+uint32_t pio_sm_get_blocking(PIO pio, uint sm);
+
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src);
+uint pio_encode_push(bool ifFull, bool block);
+uint pio_encode_set(enum pio_src_dest dest, uint value);
+
+#endif
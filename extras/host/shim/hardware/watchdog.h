@@ -0,0 +1,24 @@
+/*
+  hardware/watchdog.h - Host build shim of the Raspberry Pi Pico SDK
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef _HARDWARE_WATCHDOG_H
+#define _HARDWARE_WATCHDOG_H
+
+#include <stdint.h>
+
+inline void watchdog_enable(uint32_t delayMs, bool pauseOnDebug) {}
+inline void watchdog_update() {}
+
+#endif
@@ -0,0 +1,353 @@
+/*
+  IonoSim.cpp - Host model of the Iono RP D16 board
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoSim.h"
+#include <Arduino.h>
+#include <SPI.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include <hardware/gpio.h>
+#include "IonoD16.h"
+
+#define _MAX14912_CMD_SET_CONFIG 0x03
+#define _MAX14912_CMD_READ_REG 0x20
+#define _MAX14912_CMD_READ_RT_STAT 0x30
+#define _MAX14912_REG_IN 0
+#define _MAX14912_REG_OL 4
+#define _MAX14912_REG_THSD 5
+#define _MAX14912_REG_OV 7
+
+SerialUART Serial;
+SerialUART Serial1;
+SPIClassRP2040 SPI;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+namespace IonoSim {
+
+Max22190 max22190[2];
+Max14912 max14912[2];
+int pins[64];
+int pinModes[64];
+bool led;
+uint32_t spiClockHz;
+void (*frameHook)(int cs);
+
+static unsigned long _us;
+static uint32_t _ns;
+static bool _spiTiming;
+
+static uint32_t _berAboveHz;
+static uint32_t _berOneIn;
+static uint32_t _berSeed;
+
+static int _cs = -1;
+static bool _multi;
+static int _nb;
+static uint8_t _mosi[3];
+static uint8_t _miso[3];
+
+uint8_t max22190Crc(uint8_t b2, uint8_t b1, uint8_t b0) {
+  // x^5 + x^4 + x^2 + 1 over the 19 data bits, start value 0b00111
+  uint32_t v = ((uint32_t) b2 << 16) | ((uint32_t) b1 << 8) | (b0 & 0xe0) | 0x07;
+  for (int i = 23; i >= 5; i--) {
+    if ((v >> i) & 1) {
+      v ^= 0x35ul << (i - 5);
+    }
+  }
+  return v & 0x1f;
+}
+
+static uint8_t _max14912CrcLoop(uint8_t crc, uint8_t b) {
+  for (int i = 0; i < 8; i++) {
+    crc <<= 1;
+    if (crc & 0x80) {
+      crc ^= 0xb7;
+    }
+    if (b & 0x80) {
+      crc ^= 1;
+    }
+    b <<= 1;
+  }
+  return crc;
+}
+
+uint8_t max14912Crc(uint8_t b1, uint8_t b0) {
+  uint8_t crc = _max14912CrcLoop(0x7f, b1);
+  crc = _max14912CrcLoop(crc, b0);
+  return _max14912CrcLoop(crc, 0x80) & 0x7f;
+}
+
+unsigned long nowUs() {
+  return _us;
+}
+
+void advanceUs(unsigned long us) {
+  _us += us;
+}
+
+void spiTiming(bool enabled) {
+  _spiTiming = enabled;
+  _ns = 0;
+}
+
+void spiBitErrors(uint32_t aboveHz, uint32_t oneIn, uint32_t seed) {
+  _berAboveHz = aboveHz;
+  _berOneIn = oneIn;
+  _berSeed = seed;
+}
+
+static uint32_t _rand() {
+  _berSeed = _berSeed * 1103515245ul + 12345ul;
+  return _berSeed >> 16;
+}
+
+static uint8_t _bitRev(uint8_t b) {
+  uint8_t r = 0;
+  for (int i = 0; i < 8; i++) {
+    if ((b >> i) & 1) {
+      r |= 0x80 >> i;
+    }
+  }
+  return r;
+}
+
+void inputWrite(int pin, bool high) {
+  Max22190* m = &max22190[(pin - 1) / 8];
+  uint8_t bit = 0x80 >> ((pin - 1) % 8);
+  if (high) {
+    m->inputs |= bit;
+  } else {
+    m->inputs &= ~bit;
+  }
+}
+
+static uint8_t _max14912Level(int i) {
+  Max14912* m = &max14912[i];
+  return (m->reg[_MAX14912_REG_IN] & ~m->rt[_MAX14912_REG_THSD]) | m->rt[_MAX14912_REG_OV];
+}
+
+bool outputRead(int pin) {
+  return (_max14912Level((pin - 1) / 8) >> ((pin - 1) % 8)) & 1;
+}
+
+static int _chip(int cs, bool* isIn) {
+  *isIn = false;
+  switch (cs) {
+    case IONO_PIN_CS_DIL:
+      *isIn = true;
+      return 0;
+    case IONO_PIN_CS_DIH:
+      *isIn = true;
+      return 1;
+    case IONO_PIN_CS_DOL:
+      *isIn = false;
+      return 0;
+    case IONO_PIN_CS_DOH:
+      *isIn = false;
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+static bool _isCs(int pin) {
+  bool isIn;
+  return _chip(pin, &isIn) >= 0;
+}
+
+static int _csLow() {
+  int n = 0;
+  const int cs[] = {IONO_PIN_CS_DIL, IONO_PIN_CS_DIH, IONO_PIN_CS_DOL, IONO_PIN_CS_DOH};
+  for (int i = 0; i < 4; i++) {
+    if (pins[cs[i]] == LOW) {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Level of the inputs seen on the terminals, outputs included as they
+// are read back on the same terminals
+static uint8_t _max22190Level(int i) {
+  return max22190[i].inputs | _bitRev(_max14912Level(i));
+}
+
+static void _frameStart(int cs) {
+  bool isIn;
+  int i = _chip(cs, &isIn);
+  _cs = cs;
+  _multi = false;
+  _nb = 0;
+  memset(_miso, 0, sizeof(_miso));
+  if (!isIn) {
+    Max14912* m = &max14912[i];
+    _miso[0] = m->respA;
+    _miso[1] = m->respQ;
+    _miso[2] = max14912Crc(m->respA, m->respQ) | (m->respCrcErr ? 0x80 : 0);
+  }
+}
+
+static void _max22190Frame(Max22190* m) {
+  m->frames++;
+  if ((_mosi[2] & 0x1f) != max22190Crc(_mosi[0], _mosi[1], _mosi[2])) {
+    m->crcErrors++;
+    return;
+  }
+  if (_mosi[0] & 0x80) {
+    m->reg[_mosi[0] & 0x1f] = _mosi[1];
+  }
+}
+
+static void _max14912Frame(Max14912* m) {
+  m->frames++;
+  m->respA = 0;
+  m->respQ = 0;
+  m->respCrcErr = (_mosi[2] & 0x7f) != max14912Crc(_mosi[0], _mosi[1]);
+  if (m->respCrcErr) {
+    m->crcErrors++;
+    return;
+  }
+  if (_mosi[0] & 0x80) {
+    for (int k = _MAX14912_REG_OL; k < 8; k++) {
+      m->reg[k] = 0;
+    }
+  }
+  for (int k = _MAX14912_REG_OL; k < 8; k++) {
+    m->reg[k] |= m->rt[k];
+  }
+  uint8_t cmd = _mosi[0] & 0x7f;
+  if (cmd <= _MAX14912_CMD_SET_CONFIG) {
+    m->reg[cmd] = _mosi[1];
+  } else if (cmd == _MAX14912_CMD_READ_REG) {
+    m->reads[_mosi[1] & 0x07]++;
+    m->respA = m->rt[_mosi[1] & 0x07];
+    m->respQ = m->reg[_mosi[1] & 0x07];
+  } else if (cmd == _MAX14912_CMD_READ_RT_STAT) {
+    m->respA = m->rt[_MAX14912_REG_OL] | m->rt[_MAX14912_REG_THSD] | m->rt[_MAX14912_REG_OV];
+    m->respQ = m->reg[_MAX14912_REG_IN];
+  }
+}
+
+// Frames with more than one CS asserted only drive the LED: DIL and DIH
+// low together latch the LED state set on DOL
+static void _frameEnd() {
+  bool isIn;
+  int cs = _cs;
+  int i = _chip(cs, &isIn);
+  bool single = !_multi && _nb == 3;
+  if (single) {
+    if (isIn) {
+      _max22190Frame(&max22190[i]);
+    } else {
+      _max14912Frame(&max14912[i]);
+    }
+  }
+  _cs = -1;
+  if (single && frameHook != NULL) {
+    frameHook(cs);
+  }
+}
+
+}
+
+using namespace IonoSim;
+
+unsigned long micros() {
+  return IonoSim::nowUs();
+}
+
+unsigned long millis() {
+  return IonoSim::nowUs() / 1000;
+}
+
+void delay(unsigned long ms) {
+  IonoSim::advanceUs(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  IonoSim::advanceUs(us);
+}
+
+void pinMode(int pin, int mode) {
+  pinModes[pin] = mode;
+}
+
+void digitalWrite(int pin, int val) {
+  if (pin == IONO_PIN_MAX22190_LATCH && val == LOW && pins[pin] != LOW) {
+    for (int i = 0; i < 2; i++) {
+      max22190[i].latched = _max22190Level(i);
+    }
+  }
+  if (!_isCs(pin)) {
+    pins[pin] = val;
+    return;
+  }
+  pins[pin] = val;
+  if (val == LOW) {
+    if (_cs < 0) {
+      _frameStart(pin);
+    } else {
+      _multi = true;
+    }
+  } else if (_cs >= 0 && _csLow() == 0) {
+    _frameEnd();
+  }
+}
+
+int digitalRead(int pin) {
+  return pins[pin];
+}
+
+void gpio_put_masked(uint32_t mask, uint32_t value) {
+  for (int i = 0; i < 30; i++) {
+    if ((mask >> i) & 1) {
+      pins[i] = (value >> i) & 1;
+    }
+  }
+}
+
+void SPIClassRP2040::beginTransaction(SPISettings settings) {
+  spiClockHz = settings.clock;
+}
+
+uint8_t SPIClassRP2040::transfer(uint8_t data) {
+  bool isIn;
+  int i = _chip(_cs, &isIn);
+  if (i < 0 || _nb >= 3) {
+    return 0;
+  }
+  _mosi[_nb] = data;
+  if (!_multi && isIn && _nb == 0) {
+    Max22190* m = &max22190[i];
+    _miso[0] = pins[IONO_PIN_MAX22190_LATCH] == LOW ? m->latched : _max22190Level(i);
+    _miso[1] = (data & 0x80) ? 0 : m->reg[data & 0x1f];
+    _miso[2] = max22190Crc(_miso[0], _miso[1], 0);
+  }
+  if (pins[IONO_PIN_CS_DIL] == LOW && pins[IONO_PIN_CS_DIH] == LOW) {
+    led = pins[IONO_PIN_CS_DOL] == LOW;
+  }
+  uint8_t r = _multi ? 0 : _miso[_nb];
+  _nb++;
+  if (_berOneIn != 0 && spiClockHz > _berAboveHz && _rand() % _berOneIn == 0) {
+    r ^= 1 << (_rand() % 8);
+  }
+  if (_spiTiming && spiClockHz != 0) {
+    _ns += 8000000000ull / spiClockHz;
+    _us += _ns / 1000;
+    _ns %= 1000;
+  }
+  return r;
+}
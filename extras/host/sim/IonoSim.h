@@ -0,0 +1,105 @@
+/*
+  IonoSim.h - Host model of the Iono RP D16 board
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef IonoSim_h
+#define IonoSim_h
+
+#include <stdint.h>
+
+// Models the GPIOs, the simulated time, the PIO state machines and the
+// SPI peripherals seen by the library. Both RP2040 cores are run by the
+// test on a single thread, time only advances when requested
+
+namespace IonoSim {
+
+// MAX22190, answers in the same frame: inputs state, register data
+// and 5-bit CRC. Requests with a wrong CRC are counted and ignored.
+// The inputs state is transparent while LATCH is high and frozen at
+// its falling edge while low
+struct Max22190 {
+  uint8_t inputs; // external level of IN8 (bit 7) ... IN1 (bit 0)
+  uint8_t latched;
+  uint8_t reg[32];
+  uint32_t frames;
+  uint32_t crcErrors;
+};
+
+// MAX14912, answers in the next frame: A byte, Q byte and 7-bit CRC
+// with bit 7 flagging a wrong CRC in the previous request, which is
+// ignored.
+// The fault registers 4 ... 7 latch the real-time status at each frame
+// and are reset by a frame with the Z bit set, those still active latch
+// again. READ_RT_STAT answers with the real-time faults of each output,
+// OR of open-load, thermal shutdown and over-voltage, and the outputs
+// state. An output in thermal shutdown is switched off, one with an
+// external over-voltage is seen high at the terminal
+struct Max14912 {
+  uint8_t reg[8]; // Q byte of READ_REG, REG_IN = outputs state
+  uint8_t rt[8]; // A byte of READ_REG, real-time status, set by tests
+  uint32_t reads[8]; // READ_REG requests of each register
+  uint32_t frames;
+  uint32_t crcErrors;
+  uint8_t respA;
+  uint8_t respQ;
+  bool respCrcErr;
+};
+
+// [0] = D1 ... D8, [1] = D9 ... D16
+extern Max22190 max22190[2];
+extern Max14912 max14912[2];
+
+extern int pins[64];
+extern int pinModes[64];
+extern bool led;
+
+// SCLK of the ongoing transaction
+extern uint32_t spiClockHz;
+
+// Called at the end of each frame addressed to a single chip, with its
+// CS pin, e.g. to change the inputs between two reads
+extern void (*frameHook)(int cs);
+
+unsigned long nowUs();
+void advanceUs(unsigned long us);
+
+// Advances the time by the duration of each SPI byte at the current
+// clock, so that micros() measures the bus time of process()
+void spiTiming(bool enabled);
+
+// Flips a random bit of one MISO byte out of oneIn, on average, while
+// SCLK is above aboveHz. oneIn = 0 disables the errors
+void spiBitErrors(uint32_t aboveHz, uint32_t oneIn, uint32_t seed = 1);
+
+// Level of D1 ... D16 driven by the external circuit
+void inputWrite(int pin, bool high);
+
+// Level of D1 ... D16 at the terminal as driven by the MAX14912: the
+// programmed state, off in thermal shutdown, high on over-voltage
+bool outputRead(int pin);
+
+// Runs all the enabled state machines of both PIOs for the given
+// system clock cycles, with their clock dividers
+void pioStep(unsigned long cycles);
+
+// Advances the time running the PIOs in step
+void runUs(unsigned long us);
+
+// Reference CRCs, computed bit by bit as in the datasheets
+uint8_t max22190Crc(uint8_t b2, uint8_t b1, uint8_t b0);
+uint8_t max14912Crc(uint8_t b1, uint8_t b0);
+
+}
+
+#endif
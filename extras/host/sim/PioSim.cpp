@@ -0,0 +1,415 @@
+/*
+  PioSim.cpp - Host model of the RP2040 PIO blocks
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoSim.h"
+#include <hardware/pio.h>
+#include <hardware/clocks.h>
+
+// Executes the instructions used by the library: JMP, WAIT, IN, OUT,
+// PUSH, MOV and SET, with delays and wrapping. IN and OUT shift right,
+// without autopush/autopull. A non-blocking PUSH on a full RX FIFO sets
+// the RXSTALL flag of FDEBUG. Side-set, IRQ and the TX FIFO are not
+// modelled
+
+#define _PIO_INSTR_MEM 32
+#define _PIO_SM_NUM 4
+#define _PIO_FIFO_DEPTH 4
+
+#define _OP_JMP 0
+#define _OP_WAIT 1
+#define _OP_IN 2
+#define _OP_OUT 3
+#define _OP_PUSH_PULL 4
+#define _OP_MOV 5
+#define _OP_IRQ 6
+#define _OP_SET 7
+
+struct smStr {
+  bool enabled;
+  uint pc;
+  uint wrapTarget;
+  uint wrap;
+  uint inBase;
+  uint jmpPin;
+  float clkdiv;
+  float clkAcc;
+  uint32_t x;
+  uint32_t y;
+  uint32_t isr;
+  uint32_t osr;
+  int delay;
+  uint32_t rx[2 * _PIO_FIFO_DEPTH];
+  uint rxHead;
+  uint rxLevel;
+  uint rxDepth;
+  int execPending;
+};
+
+struct pioStr {
+  pio_hw_t hw;
+  uint16_t instr[_PIO_INSTR_MEM];
+  uint used;
+  uint claimed;
+  struct smStr sm[_PIO_SM_NUM];
+};
+
+static struct pioStr _pio[2];
+
+PIO pio0 = &_pio[0].hw;
+PIO pio1 = &_pio[1].hw;
+
+static struct pioStr* _pioGet(PIO pio) {
+  return pio == pio1 ? &_pio[1] : &_pio[0];
+}
+
+static struct smStr* _sm(PIO pio, uint sm) {
+  return &_pioGet(pio)->sm[sm];
+}
+
+static uint32_t _pins(uint base) {
+  uint32_t v = 0;
+  for (int i = 0; i < 32; i++) {
+    if (IonoSim::pins[(base + i) % 32]) {
+      v |= 1ul << i;
+    }
+  }
+  return v;
+}
+
+static bool _rxPush(struct smStr* s, uint32_t v) {
+  if (s->rxLevel >= s->rxDepth) {
+    return false;
+  }
+  s->rx[(s->rxHead + s->rxLevel) % s->rxDepth] = v;
+  s->rxLevel++;
+  return true;
+}
+
+static uint32_t _src(struct smStr* s, uint src) {
+  switch (src) {
+    case pio_pins:
+      return _pins(s->inBase);
+    case pio_x:
+      return s->x;
+    case pio_y:
+      return s->y;
+    case pio_isr:
+      return s->isr;
+    case pio_osr:
+      return s->osr;
+    default:
+      return 0;
+  }
+}
+
+static void _dest(struct smStr* s, uint dest, uint32_t v) {
+  switch (dest) {
+    case pio_x:
+      s->x = v;
+      break;
+    case pio_y:
+      s->y = v;
+      break;
+    case pio_isr:
+      s->isr = v;
+      break;
+    case pio_osr:
+      s->osr = v;
+      break;
+  }
+}
+
+// Executes one instruction, returns false if the state machine stalls.
+// Instructions forced with pio_sm_exec() don't advance the PC
+static bool _exec(struct pioStr* p, struct smStr* s, uint16_t instr, bool forced) {
+  uint op = instr >> 13;
+  uint arg1 = (instr >> 5) & 0x07;
+  uint arg2 = instr & 0x1f;
+  uint next = s->pc;
+  if (!forced) {
+    next = s->pc == s->wrap ? s->wrapTarget : (s->pc + 1) % _PIO_INSTR_MEM;
+  }
+  uint32_t v;
+  bool jmp;
+
+  switch (op) {
+    case _OP_JMP:
+      switch (arg1) {
+        case 0:
+          jmp = true;
+          break;
+        case 1:
+          jmp = s->x == 0;
+          break;
+        case 2:
+          jmp = s->x-- != 0;
+          break;
+        case 3:
+          jmp = s->y == 0;
+          break;
+        case 4:
+          jmp = s->y-- != 0;
+          break;
+        case 5:
+          jmp = s->x != s->y;
+          break;
+        case 6:
+          jmp = IonoSim::pins[s->jmpPin] != 0;
+          break;
+        default:
+          jmp = false;
+          break;
+      }
+      if (jmp) {
+        next = arg2;
+      }
+      break;
+
+    case _OP_WAIT:
+      v = arg1 & 0x03;
+      if (v == 0) {
+        v = IonoSim::pins[arg2];
+      } else if (v == 1) {
+        v = IonoSim::pins[(s->inBase + arg2) % 32];
+      } else {
+        v = (arg1 >> 2) & 1;
+      }
+      if ((v != 0) != (((arg1 >> 2) & 1) != 0)) {
+        return false;
+      }
+      break;
+
+    case _OP_IN:
+      arg2 = arg2 == 0 ? 32 : arg2;
+      v = _src(s, arg1);
+      if (arg2 == 32) {
+        s->isr = v;
+      } else {
+        s->isr = (s->isr >> arg2) | ((v & ((1ul << arg2) - 1)) << (32 - arg2));
+      }
+      break;
+
+    case _OP_OUT:
+      arg2 = arg2 == 0 ? 32 : arg2;
+      v = arg2 == 32 ? s->osr : s->osr & ((1ul << arg2) - 1);
+      s->osr = arg2 == 32 ? 0 : s->osr >> arg2;
+      _dest(s, arg1, v);
+      break;
+
+    case _OP_PUSH_PULL:
+      if ((instr & 0x80) == 0) {
+        if (!_rxPush(s, s->isr)) {
+          if (instr & 0x20) {
+            return false;
+          }
+          p->hw.fdebug.bits |= 1u << (PIO_FDEBUG_RXSTALL_LSB + (s - p->sm));
+        }
+        s->isr = 0;
+      }
+      break;
+
+    case _OP_MOV:
+      v = _src(s, arg2 & 0x07);
+      if (((arg2 >> 3) & 0x03) == 1) {
+        v = ~v;
+      }
+      _dest(s, arg1, v);
+      break;
+
+    case _OP_SET:
+      _dest(s, arg1, arg2);
+      break;
+  }
+
+  s->pc = next;
+  s->delay = (instr >> 8) & 0x1f;
+  return true;
+}
+
+static void _step(struct pioStr* p, struct smStr* s) {
+  if (s->execPending >= 0) {
+    if (_exec(p, s, s->execPending, true)) {
+      s->execPending = -1;
+    }
+    return;
+  }
+  if (s->delay > 0) {
+    s->delay--;
+    return;
+  }
+  _exec(p, s, p->instr[s->pc], false);
+}
+
+namespace IonoSim {
+
+// The state machines don't interact, so each one runs all its steps
+// in turn
+void pioStep(unsigned long cycles) {
+  for (int i = 0; i < 2; i++) {
+    for (int j = 0; j < _PIO_SM_NUM; j++) {
+      struct smStr* s = &_pio[i].sm[j];
+      if (!s->enabled) {
+        continue;
+      }
+      s->clkAcc += cycles;
+      while (s->clkAcc >= s->clkdiv) {
+        s->clkAcc -= s->clkdiv;
+        _step(&_pio[i], s);
+      }
+    }
+  }
+}
+
+void runUs(unsigned long us) {
+  for (unsigned long i = 0; i < us; i++) {
+    pioStep(IONO_SIM_CLK_SYS_HZ / 1000000);
+    advanceUs(1);
+  }
+}
+
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t* program) {
+  return _pioGet(pio)->used + program->length <= _PIO_INSTR_MEM;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program) {
+  struct pioStr* p = _pioGet(pio);
+  uint offset = p->used;
+  for (int i = 0; i < program->length; i++) {
+    uint16_t instr = program->instructions[i];
+    if ((instr >> 13) == _OP_JMP) {
+      instr = (instr & ~0x1f) | ((instr + offset) & 0x1f);
+    }
+    p->instr[offset + i] = instr;
+  }
+  p->used += program->length;
+  return offset;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required) {
+  struct pioStr* p = _pioGet(pio);
+  for (int i = 0; i < _PIO_SM_NUM; i++) {
+    if ((p->claimed & (1 << i)) == 0) {
+      p->claimed |= 1 << i;
+      return i;
+    }
+  }
+  return -1;
+}
+
+pio_sm_config pio_get_default_sm_config() {
+  pio_sm_config c;
+  c.wrapTarget = 0;
+  c.wrap = _PIO_INSTR_MEM - 1;
+  c.inBase = 0;
+  c.jmpPin = 0;
+  c.fifoJoinRx = false;
+  c.clkdiv = 1;
+  return c;
+}
+
+void sm_config_set_wrap(pio_sm_config* c, uint wrapTarget, uint wrap) {
+  c->wrapTarget = wrapTarget;
+  c->wrap = wrap;
+}
+
+void sm_config_set_in_pins(pio_sm_config* c, uint inBase) {
+  c->inBase = inBase;
+}
+
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin) {
+  c->jmpPin = pin;
+}
+
+void sm_config_set_fifo_join(pio_sm_config* c, enum pio_fifo_join join) {
+  c->fifoJoinRx = join == PIO_FIFO_JOIN_RX;
+}
+
+void sm_config_set_clkdiv(pio_sm_config* c, float div) {
+  c->clkdiv = div < 1 ? 1 : div;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initialPc, const pio_sm_config* config) {
+  struct smStr* s = _sm(pio, sm);
+  *s = smStr();
+  pio->fdebug = 0x01010101u << sm;
+  s->pc = initialPc;
+  s->wrapTarget = config->wrapTarget;
+  s->wrap = config->wrap;
+  s->inBase = config->inBase;
+  s->jmpPin = config->jmpPin;
+  s->clkdiv = config->clkdiv;
+  s->rxDepth = config->fifoJoinRx ? 2 * _PIO_FIFO_DEPTH : _PIO_FIFO_DEPTH;
+  s->execPending = -1;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+  _sm(pio, sm)->enabled = enabled;
+}
+
+// Executed at once unless it stalls, as a blocking PUSH on a full
+// FIFO, then retried by the state machine as on the hardware
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+  struct smStr* s = _sm(pio, sm);
+  if (!_exec(_pioGet(pio), s, instr, true)) {
+    s->execPending = instr;
+  }
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+  return _sm(pio, sm)->rxLevel == 0;
+}
+
+bool pio_sm_is_rx_fifo_full(PIO pio, uint sm) {
+  struct smStr* s = _sm(pio, sm);
+  return s->rxLevel == s->rxDepth;
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm) {
+  return _sm(pio, sm)->rxLevel;
+}
+
+// Returns 0 on an empty FIFO, as the hardware does
+uint32_t pio_sm_get(PIO pio, uint sm) {
+  struct smStr* s = _sm(pio, sm);
+  if (s->rxLevel == 0) {
+    return 0;
+  }
+  uint32_t v = s->rx[s->rxHead];
+  s->rxHead = (s->rxHead + 1) % s->rxDepth;
+  s->rxLevel--;
+  return v;
+}
+
+uint32_t pio_sm_get_blocking(PIO pio, uint sm) {
+  struct smStr* s = _sm(pio, sm);
+  for (int i = 0; i < 1000000 && s->rxLevel == 0; i++) {
+    IonoSim::pioStep(1);
+  }
+  return pio_sm_get(pio, sm);
+}
+
+uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) {
+  return (_OP_MOV << 13) | ((dest & 0x07) << 5) | (src & 0x07);
+}
+
+uint pio_encode_push(bool ifFull, bool block) {
+  return (_OP_PUSH_PULL << 13) | (ifFull ? 0x40 : 0) | (block ? 0x20 : 0);
+}
+
+uint pio_encode_set(enum pio_src_dest dest, uint value) {
+  return (_OP_SET << 13) | ((dest & 0x07) << 5) | (value & 0x1f);
+}
@@ -0,0 +1,164 @@
+/*
+  modbus.h - Modbus RTU example sketch on the simulated board
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef test_modbus_h
+#define test_modbus_h
+
+#include <vector>
+#include "IonoD16.h"
+#include "IonoSim.h"
+
+void loadConfig();
+
+#include "IonoD16ModbusRtu.ino"
+
+#define MB_TEST_UNIT CFG_MB_UNIT_ADDDR
+
+typedef std::vector<byte> Pdu;
+
+static void mbRun(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    loop();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// Stores the configuration with the given pin modes (0 = default) and
+// unit address, as committed via Modbus
+static void mbConfig(const word* modes, byte unit = MB_TEST_UNIT) {
+  loadConfig();
+  _cfgRegisters[MB_REG_CFG_OFFSET_MB_ADDR] = unit;
+  for (int i = 0; i < 16; i++) {
+    if (modes != NULL && modes[i] != 0) {
+      _cfgRegisters[MB_REG_CFG_OFFSET_MODE_D1 + i] = modes[i];
+    }
+  }
+  _cfgRegisters[MB_REG_CFG_OFFSET_COMMIT] = CFG_COMMIT_VAL;
+  configCommit(_cfgRegisters, MB_REG_CFG_OFFSET_MAX + 1);
+  configReset = false;
+  memset(_cfgRegisters, 0, sizeof(_cfgRegisters));
+}
+
+// Stores the configuration and starts the sketch as after a reset
+static void mbStart(const word* modes, byte unit = MB_TEST_UNIT) {
+  IonoSim::pins[IONO_PIN_CS_DOL] = HIGH;
+  mbConfig(modes, unit);
+  setup1();
+  Iono.process();
+  setup();
+  mbRun(10);
+}
+
+static std::vector<byte> mbFrame(byte unit, byte function, const Pdu& pdu) {
+  std::vector<byte> frame;
+  frame.push_back(unit);
+  frame.push_back(function);
+  frame.insert(frame.end(), pdu.begin(), pdu.end());
+  word crc = rtuCrc(frame.data(), frame.size());
+  frame.push_back(crc & 0xff);
+  frame.push_back(crc >> 8);
+  return frame;
+}
+
+// Response PDU sent since the last request (function code included),
+// empty if no or a corrupted response
+static Pdu mbResponse(byte unit) {
+  std::vector<byte> resp = IONO_RS485.tx;
+  if (resp.size() < 4 || resp[0] != unit) {
+    return Pdu();
+  }
+  word crc = rtuCrc(resp.data(), resp.size() - 2);
+  if (resp[resp.size() - 2] != (crc & 0xff) || resp[resp.size() - 1] != (crc >> 8)) {
+    return Pdu();
+  }
+  return Pdu(resp.begin() + 1, resp.end() - 2);
+}
+
+// Sends a request frame, followed by the 3.5 characters silence, and
+// runs one process() cycle, returns the response PDU (function code
+// included), empty if no or a corrupted response
+static Pdu mbRequest(byte unit, byte function, const Pdu& pdu) {
+  IONO_RS485.rx = mbFrame(unit, function, pdu);
+  IONO_RS485.tx.clear();
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us);
+  modbusProcess();
+  Iono.process();
+  return mbResponse(unit);
+}
+
+struct mbBusFrameStr {
+  unsigned long startUs;
+  std::vector<byte> bytes;
+};
+
+// Virtual bus: feeds the frames to the RX buffer byte by byte at the
+// baud rate from their start time (µs), while running process() every
+// millisecond and loop() every loopUs from loopPhaseUs, in steps of
+// stepUs. Stops when done(t) returns true, returning t, or at untilUs
+// returning -1
+template<class F>
+static long mbBusRun(const std::vector<struct mbBusFrameStr>& frames, unsigned long baud,
+    unsigned long loopUs, unsigned long loopPhaseUs, unsigned long stepUs, unsigned long untilUs, F done) {
+  unsigned long charUs = 11000000ul / baud;
+  unsigned long t0 = micros();
+  unsigned long nextLoop = loopPhaseUs;
+  unsigned long nextProcess = 0;
+  size_t f = 0;
+  size_t b = 0;
+  for (unsigned long t = 0; t < untilUs; t += stepUs) {
+    while (f < frames.size() && frames[f].startUs + (b + 1) * charUs <= t) {
+      IONO_RS485.rx.push_back(frames[f].bytes[b]);
+      if (++b == frames[f].bytes.size()) {
+        f++;
+        b = 0;
+      }
+    }
+    if (t >= nextProcess) {
+      Iono.process();
+      nextProcess += 1000;
+    }
+    if (t >= nextLoop) {
+      loop();
+      nextLoop += loopUs;
+    }
+    if (done(t)) {
+      return t;
+    }
+    IonoSim::advanceUs(t0 + t + stepUs - micros());
+  }
+  return -1;
+}
+
+static Pdu mbWords(std::initializer_list<word> words) {
+  Pdu pdu;
+  for (word w : words) {
+    pdu.push_back(w >> 8);
+    pdu.push_back(w & 0xff);
+  }
+  return pdu;
+}
+
+static word mbRead(byte function, word addr) {
+  Pdu r = mbRequest(MB_TEST_UNIT, function, mbWords({addr, 1}));
+  return r.size() == 4 ? (r[2] << 8) | r[3] : 0xffff;
+}
+
+static word mbReadHolding(word addr) {
+  return mbRead(MB_FC_READ_HOLDING_REGISTERS, addr);
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+  test.h - Checks for the host tests of the library
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#ifndef test_h
+#define test_h
+
+#include <stdio.h>
+
+static int _testFailures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      _testFailures++; \
+    } \
+  } while (0)
+
+#define TEST_END() do { \
+    printf("%s\n", _testFailures == 0 ? "OK" : "FAILED"); \
+    return _testFailures == 0 ? 0 : 1; \
+  } while (0)
+
+#endif
@@ -0,0 +1,140 @@
+/*
+  test_cmd.cpp - Commands queue: full queue, status across the handles
+  wrap-around, execution order with the producer on another thread
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "IonoSim.h"
+#include "test.h"
+
+#define private public
+#include "IonoD16.h"
+#undef private
+
+#define ORDER_CMDS 5000
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+static uint16_t outputs() {
+  uint16_t o = 0;
+  for (int p = D1; p <= D16; p++) {
+    if (IonoSim::outputRead(p)) {
+      o |= 1 << (p - D1);
+    }
+  }
+  return o;
+}
+
+// Handles and outputs seen by the callback, in execution order
+static std::vector<int> _done;
+static std::vector<uint16_t> _doneOutputs;
+
+static void cmdCb(int handle, bool ok) {
+  _done.push_back(ok ? handle : -1);
+  _doneOutputs.push_back(outputs());
+}
+
+// Fills the queue, checks the statuses, executes it
+static void fill(uint32_t start) {
+  int h[IONO_CMD_QUEUE_LEN];
+  Iono._cmdHead = start;
+  Iono._cmdTail = start;
+  for (int i = 0; i < IONO_CMD_QUEUE_LEN; i++) {
+    h[i] = Iono.cmdWrite(D1 + (i % 8), i % 2 == 0 ? HIGH : LOW);
+    CHECK(h[i] == (int) ((start + i) & 0x7fffffff));
+    CHECK(Iono.cmdStatus(h[i]) == IONO_CMD_PENDING);
+  }
+  CHECK(Iono.cmdWrite(D1, LOW) == -1);
+  CHECK(Iono.cmdStatus((h[IONO_CMD_QUEUE_LEN - 1] + 1) & 0x7fffffff) == IONO_CMD_UNKNOWN);
+  _done.clear();
+  run(1);
+  CHECK(_done.size() == IONO_CMD_QUEUE_LEN);
+  for (int i = 0; i < IONO_CMD_QUEUE_LEN; i++) {
+    CHECK(Iono.cmdStatus(h[i]) == IONO_CMD_OK);
+    CHECK(i >= (int) _done.size() || _done[i] == h[i]);
+  }
+
+  // statuses kept until the slots are reused by newer commands
+  for (int i = 0; i < IONO_CMD_QUEUE_LEN; i++) {
+    int n = Iono.cmdWrite(D9, HIGH);
+    CHECK(n >= 0);
+    CHECK(Iono.cmdStatus(h[i]) == IONO_CMD_UNKNOWN);
+    if (i + 1 < IONO_CMD_QUEUE_LEN) {
+      CHECK(Iono.cmdStatus(h[i + 1]) == IONO_CMD_OK);
+    }
+  }
+  run(1);
+}
+
+int main() {
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D16; p++) {
+    CHECK(Iono.pinMode(p, p == D16 ? INPUT : OUTPUT_HS));
+  }
+  Iono.cmdCallback(cmdCb);
+  run(10);
+
+  // invalid handles, failed commands
+  CHECK(Iono.cmdStatus(-1) == IONO_CMD_UNKNOWN);
+  CHECK(Iono.cmdStatus(12345) == IONO_CMD_UNKNOWN);
+  int h = Iono.cmdWrite(D16, HIGH);
+  CHECK(Iono.cmdStatus(h) == IONO_CMD_PENDING);
+  run(1);
+  CHECK(Iono.cmdStatus(h) == IONO_CMD_FAILED);
+
+  // full queue, around the 31-bit handles and the 32-bit counters wrap
+  fill(0);
+  fill(0x7fffffff - IONO_CMD_QUEUE_LEN / 2);
+  fill(0xffffffff - IONO_CMD_QUEUE_LEN / 2);
+
+  // the other core enqueues while process() runs: every command is
+  // executed once, in order, with its own arguments
+  _done.clear();
+  _doneOutputs.clear();
+  std::atomic<bool> stop(false);
+  std::vector<int> handles;
+  std::thread producer([&handles, &stop]() {
+    for (int i = 1; i <= ORDER_CMDS; i++) {
+      int h;
+      while ((h = Iono.cmdWriteMask(0x7fff, i & 0x7fff)) < 0) {
+        std::this_thread::yield();
+      }
+      handles.push_back(h);
+    }
+    stop = true;
+  });
+  while (!stop || Iono._cmdTail != Iono._cmdHead) {
+    run(1);
+  }
+  producer.join();
+  CHECK(_done.size() == ORDER_CMDS);
+  CHECK(_done == handles);
+  for (size_t i = 0; i < _doneOutputs.size(); i++) {
+    CHECK(_doneOutputs[i] == ((i + 1) & 0x7fff));
+  }
+  for (int h : handles) {
+    if (Iono.cmdStatus(h) != IONO_CMD_UNKNOWN) {
+      CHECK(Iono.cmdStatus(h) == IONO_CMD_OK);
+    }
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,198 @@
+/*
+  test_configure.cpp - configure() against the equivalent pinMode() and
+  outputsJoin() calls
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define HS OUTPUT_HS
+#define PP OUTPUT_PP
+#define IN INPUT
+
+#define MAX22190_REG_FLT1 0x06
+
+struct caseStr {
+  const char* name;
+  IonoD16PinConfig cfg[16];
+};
+
+// {mode, wbol, join}
+static const struct caseStr _cases[] = {
+  {"outputs", {
+    {HS, false, false}, {HS, false, true}, {HS, true, false}, {HS, false, false},
+    {HS, false, false}, {HS, false, false}, {HS, false, false}, {HS, false, false},
+    {HS, false, false}, {HS, false, false}, {HS, false, true}, {HS, false, false},
+    {HS, true, false}, {HS, true, false}, {HS, false, false}, {HS, false, false}
+  }},
+  {"mixed", {
+    {IN, false, false}, {IN, true, false}, {IN, false, false}, {IN, true, false},
+    {HS, false, true}, {HS, false, false}, {IN, false, false}, {IN, true, false},
+    {PP, false, false}, {HS, true, false}, {PP, false, false}, {IN, true, false},
+    {IN, false, false}, {HS, false, false}, {HS, true, false}, {HS, true, true}
+  }},
+  {"inputs", {
+    {IN, true, false}, {IN, true, false}, {IN, false, false}, {IN, false, false},
+    {IN, true, false}, {IN, true, false}, {IN, false, false}, {IN, false, false},
+    {IN, false, false}, {IN, false, false}, {IN, true, false}, {IN, true, false},
+    {IN, false, false}, {IN, false, false}, {IN, true, false}, {IN, true, false}
+  }},
+};
+
+#define CASES_NUM ((int) (sizeof(_cases) / sizeof(_cases[0])))
+
+// Outputs driven high when each inputs peripheral is first addressed
+static uint16_t _outputsAtInputs;
+static bool _inputsSeen[2];
+
+static void frameHook(int cs) {
+  int i = cs == IONO_PIN_CS_DIL ? 0 : cs == IONO_PIN_CS_DIH ? 1 : -1;
+  if (i >= 0 && !_inputsSeen[i]) {
+    _inputsSeen[i] = true;
+    for (int d = D1 + i * 8; d < D1 + (i + 1) * 8; d++) {
+      if (IonoSim::outputRead(d)) {
+        _outputsAtInputs |= 1 << (d - D1);
+      }
+    }
+  }
+}
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// Prints the peripherals registers and the applied modes
+static void image() {
+  for (int i = 0; i < 2; i++) {
+    for (int r = 0; r < 4; r++) {
+      printf("%02x ", IonoSim::max14912[i].reg[r]);
+    }
+    for (int k = 0; k < 8; k++) {
+      printf("%02x ", IonoSim::max22190[i].reg[MAX22190_REG_FLT1 + k * 2]);
+    }
+  }
+  for (int d = D1; d <= D16; d++) {
+    printf("%d ", Iono.pinModeRead(d));
+  }
+  printf("\n");
+}
+
+// Child process: applies a case on a freshly set up board
+static int apply(const struct caseStr* c, bool perPin) {
+  if (!Iono.setup()) {
+    return 1;
+  }
+  run(10);
+  if (perPin) {
+    for (int d = D1; d <= D16; d++) {
+      if (!Iono.pinMode(d, c->cfg[d - D1].mode, c->cfg[d - D1].wbol)) {
+        return 1;
+      }
+    }
+    for (int d = D1; d <= D16; d++) {
+      if (c->cfg[d - D1].join && !Iono.outputsJoin(d)) {
+        return 1;
+      }
+    }
+  } else if (!Iono.configure(c->cfg)) {
+    return 1;
+  }
+  run(10);
+  image();
+  return 0;
+}
+
+static std::string child(const char* self, const char* name, const char* path) {
+  char cmd[256];
+  char line[512];
+  std::string out;
+  snprintf(cmd, sizeof(cmd), "\"%s\" %s %s", self, name, path);
+  FILE* f = popen(cmd, "r");
+  if (f == NULL) {
+    return out;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    out += line;
+  }
+  if (pclose(f) != 0) {
+    out.clear();
+  }
+  return out;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    for (int i = 0; i < CASES_NUM; i++) {
+      if (strcmp(argv[1], _cases[i].name) == 0) {
+        return apply(&_cases[i], strcmp(argv[2], "pins") == 0);
+      }
+    }
+    return 1;
+  }
+
+  for (int i = 0; i < CASES_NUM; i++) {
+    std::string pins = child(argv[0], _cases[i].name, "pins");
+    std::string cfg = child(argv[0], _cases[i].name, "configure");
+    CHECK(!pins.empty());
+    CHECK(cfg == pins);
+    if (cfg != pins) {
+      printf("%s pins:      %s", _cases[i].name, pins.c_str());
+      printf("%s configure: %s", _cases[i].name, cfg.c_str());
+    }
+  }
+
+  // not joinable: D1-D2 with D3 push-pull, nothing applied
+  IonoD16PinConfig cfg[16];
+  memcpy(cfg, _cases[0].cfg, sizeof(cfg));
+  cfg[2].mode = PP;
+  cfg[2].wbol = false;
+  CHECK(Iono.setup());
+  run(10);
+  CHECK(!Iono.configure(cfg));
+  for (int d = D1; d <= D16; d++) {
+    CHECK(Iono.pinModeRead(d) == INPUT);
+  }
+  CHECK(Iono.pinModeRead(D16 + 1) == -1);
+  cfg[1].join = false;
+  CHECK(Iono.configure(cfg));
+  CHECK(Iono.pinModeRead(D3) == PP);
+  CHECK(Iono.pinModeRead(D1) == HS);
+
+  // joinable pairs with the modes of a configuration
+  CHECK(!Iono.outputsJoinable(D1, cfg));
+  CHECK(Iono.outputsJoinable(D5, cfg));
+  CHECK(Iono.outputsJoinable(D16, _cases[1].cfg));
+  CHECK(!Iono.outputsJoinable(D9, _cases[1].cfg));
+  CHECK(!Iono.outputsJoinable(D16 + 1, cfg));
+
+  // outputs turning into inputs are switched off before the inputs are
+  // configured
+  CHECK(Iono.writeMask(0xffff, 0xffff));
+  run(10);
+  IonoSim::frameHook = frameHook;
+  CHECK(Iono.configure(_cases[2].cfg));
+  IonoSim::frameHook = NULL;
+  CHECK(_inputsSeen[0] && _inputsSeen[1]);
+  CHECK(_outputsAtInputs == 0);
+
+  TEST_END();
+}
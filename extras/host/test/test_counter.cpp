@@ -0,0 +1,79 @@
+/*
+  test_counter.cpp - PIO counter reads on the PIO model
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <math.h>
+#include <mutex>
+#include <Arduino.h>
+#include <SPI.h>
+#include <hardware/pio.h>
+#include "IonoSim.h"
+#include "test.h"
+
+#define private public
+#include "IonoD16.h"
+#undef private
+
+// Square wave on the pin, periodUs with highUs high, for the given time
+static void wave(int pin, unsigned long periodUs, unsigned long highUs, unsigned long us) {
+  for (unsigned long t = 0; t < us; t++) {
+    IonoSim::pins[pin] = (t % periodUs) < highUs ? HIGH : LOW;
+    IonoSim::runUs(1);
+  }
+  IonoSim::pins[pin] = LOW;
+}
+
+int main() {
+  uint32_t count;
+  float freq, duty;
+
+  CHECK(Iono.setup());
+  CHECK(!Iono.counterRead(DT1, &count));
+  CHECK(Iono.counterSetup(DT1));
+  CHECK(Iono.counterSetup(DT2));
+
+  CHECK(Iono.counterRead(DT1, &count));
+  CHECK(count == 0);
+
+  wave(DT1, 1000, 250, 20000);
+  CHECK(Iono.counterRead(DT1, &count));
+  CHECK(count == 20);
+  CHECK(Iono.counterRead(DT2, &count));
+  CHECK(count == 0);
+
+  CHECK(Iono.counterFrequencyRead(DT1, &freq, &duty));
+  wave(DT1, 500, 250, 10000);
+  CHECK(Iono.counterFrequencyRead(DT1, &freq, &duty));
+  CHECK(fabsf(freq - 2000) < 1);
+  CHECK(fabsf(duty - 0.5f) < 0.01f);
+
+  // leftovers in the RX FIFO, as from a read interrupted on the other
+  // core, and a full FIFO must not corrupt the next read
+  struct IonoD16Class::counterStr* c = &Iono._counter[0];
+  for (int i = 0; i < 4; i++) {
+    pio_sm_exec(c->pio, c->sm, pio_encode_mov(pio_isr, pio_null));
+    pio_sm_exec(c->pio, c->sm, pio_encode_push(false, false));
+  }
+  CHECK(pio_sm_is_rx_fifo_full(c->pio, c->sm));
+  CHECK(Iono.counterRead(DT1, &count));
+  CHECK(count == 40);
+  CHECK(pio_sm_is_rx_fifo_empty(c->pio, c->sm));
+
+  pio_sm_exec(c->pio, c->sm, pio_encode_push(false, false));
+  wave(DT1, 100, 50, 1000);
+  CHECK(Iono.counterRead(DT1, &count));
+  CHECK(count == 50);
+
+  TEST_END();
+}
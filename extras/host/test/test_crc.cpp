@@ -0,0 +1,154 @@
+/*
+  test_crc.cpp - Table-driven CRCs against the bitwise implementations
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <time.h>
+#include <mutex>
+#include <Arduino.h>
+#include <SPI.h>
+#include <hardware/pio.h>
+#include "IonoSim.h"
+#include "test.h"
+
+#define private public
+#include "IonoD16.h"
+#undef private
+
+// Bitwise implementations the tables replaced
+
+static byte _refMax22190Crc(byte data2, byte data1, byte data0) {
+  int length = 19; // 19-bit data
+  byte crc_init = 0x07; // 5-bit init word, constant, 00111
+  byte crc_poly = 0x35; // 6-bit polynomial, constant, 110101
+  byte crc_step;
+  byte tmp;
+
+  uint32_t datainput = (unsigned long)((data2 << 16) + (data1 << 8) + data0);
+  datainput = (datainput & 0xffffe0) + crc_init;
+  tmp = (byte)((datainput & 0xfc0000) >> 18);
+  if ((tmp & 0x20) == 0x20)
+    crc_step = (byte)(tmp ^ crc_poly);
+  else
+    crc_step = tmp;
+
+  for (int i = 0; i < length - 1; i++) {
+    tmp = (byte)(((crc_step & 0x1f) << 1) + ((datainput >> (length - 2 - i)) & 0x01));
+    if ((tmp & 0x20) == 0x20)
+      crc_step = (byte)(tmp ^ crc_poly);
+    else
+      crc_step = tmp;
+  }
+
+  return (byte)(crc_step & 0x1f);
+}
+
+static byte _refMax14912CrcLoop(byte crc, byte byte1) {
+  for (int i = 0; i < 8; i++) {
+    crc <<= 1;
+    if (crc & 0x80)
+      crc ^= 0xB7; // 0x37 with MSBit on purpose
+    if (byte1 & 0x80)
+      crc ^=1;
+    byte1 <<= 1;
+  }
+  return crc;
+}
+
+static byte _refMax14912Crc(byte byte1, byte byte2) {
+  byte synd;
+  synd = _refMax14912CrcLoop(0x7f, byte1);
+  synd = _refMax14912CrcLoop(synd, byte2);
+  return _refMax14912CrcLoop(synd, 0x80) & 0x7f;
+}
+
+static volatile byte _sink;
+
+static double _nsPerCall(byte (*f)(uint32_t), uint32_t n) {
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int r = 0; r < 10; r++) {
+    for (uint32_t v = 0; v < n; v++) {
+      _sink = f(v);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / (10.0 * n);
+}
+
+static byte _tab22190(uint32_t v) {
+  return Iono._max22190Crc(v >> 11, v >> 3, v << 5);
+}
+
+static byte _ref22190(uint32_t v) {
+  return _refMax22190Crc(v >> 11, v >> 3, v << 5);
+}
+
+static byte _tab14912(uint32_t v) {
+  return Iono._max14912Crc(v >> 8, v);
+}
+
+static byte _ref14912(uint32_t v) {
+  return _refMax14912Crc(v >> 8, v);
+}
+
+int main() {
+  uint32_t mismatches = 0;
+
+  // all the 2^19 data bits of a MAX22190 frame, the low 5 bits of the
+  // last byte (CRC field) must not matter
+  for (uint32_t v = 0; v < (1ul << 19); v++) {
+    byte d2 = v >> 11;
+    byte d1 = v >> 3;
+    byte d0 = v << 5;
+    byte ref = _refMax22190Crc(d2, d1, d0);
+    if (Iono._max22190Crc(d2, d1, d0) != ref ||
+        Iono._max22190Crc(d2, d1, d0 | (v & 0x1f)) != ref ||
+        IonoSim::max22190Crc(d2, d1, d0) != ref) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+
+  // all the 2^16 data bits of a MAX14912 frame, Z bit included
+  mismatches = 0;
+  for (uint32_t v = 0; v < (1ul << 16); v++) {
+    byte ref = _refMax14912Crc(v >> 8, v);
+    if (Iono._max14912Crc(v >> 8, v) != ref ||
+        IonoSim::max14912Crc(v >> 8, v) != ref) {
+      mismatches++;
+    }
+  }
+  CHECK(mismatches == 0);
+
+  // the precomputed CRCs of the constant frames (register reads,
+  // READ_RT_STAT) are checked by the chip models
+  CHECK(Iono.setup());
+  for (int i = 0; i < 100; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+  for (int i = 0; i < 2; i++) {
+    CHECK(IonoSim::max22190[i].frames > 0);
+    CHECK(IonoSim::max22190[i].crcErrors == 0);
+    CHECK(IonoSim::max14912[i].frames > 0);
+    CHECK(IonoSim::max14912[i].crcErrors == 0);
+  }
+
+  printf("MAX22190 CRC: table %.2f ns, bitwise %.2f ns\n",
+      _nsPerCall(_tab22190, 1ul << 19), _nsPerCall(_ref22190, 1ul << 19));
+  printf("MAX14912 CRC: table %.2f ns, bitwise %.2f ns\n",
+      _nsPerCall(_tab14912, 1ul << 16), _nsPerCall(_ref14912, 1ul << 16));
+
+  TEST_END();
+}
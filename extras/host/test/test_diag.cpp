@@ -0,0 +1,114 @@
+/*
+  test_diag.cpp - Diagnostic registers polling: groups skipped by
+  configuration, faster polling after a new fault
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define REG_OL 4
+#define REG_THSD 5
+#define REG_OV 7
+#define MAX22190_REG_FAULT1 0x04
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// READ_REG requests of a register to each MAX14912 in the given time
+static uint32_t _reads[2];
+
+static void reads(int reg, int ms) {
+  uint32_t n[2];
+  for (int i = 0; i < 2; i++) {
+    n[i] = IonoSim::max14912[i].reads[reg];
+  }
+  run(ms);
+  for (int i = 0; i < 2; i++) {
+    _reads[i] = IonoSim::max14912[i].reads[reg] - n[i];
+  }
+}
+
+static bool readsIn(uint32_t min0, uint32_t max0, uint32_t min1, uint32_t max1) {
+  return _reads[0] >= min0 && _reads[0] <= max0 && _reads[1] >= min1 && _reads[1] <= max1;
+}
+
+int main() {
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D16; p++) {
+    CHECK(Iono.pinMode(p, OUTPUT_PP));
+  }
+  run(3000);
+
+  // all push-pull, no open-load detection: both groups skipped
+  reads(REG_OL, 1000);
+  CHECK(readsIn(0, 0, 0, 0));
+  reads(REG_OV, 1000);
+  CHECK(readsIn(0, 0, 0, 0));
+  reads(REG_THSD, 1000);
+  CHECK(readsIn(19, 21, 19, 21));
+
+  // a high-side output enables the over-voltage group, open-load
+  // detection the open-load one, only on the peripheral concerned
+  CHECK(Iono.pinMode(D2, OUTPUT_HS));
+  reads(REG_OV, 1000);
+  CHECK(readsIn(9, 11, 0, 0));
+  reads(REG_OL, 1000);
+  CHECK(readsIn(0, 0, 0, 0));
+  CHECK(Iono.pinMode(D10, OUTPUT_HS, true));
+  reads(REG_OL, 1000);
+  CHECK(readsIn(0, 0, 9, 11));
+  reads(REG_OV, 1000);
+  CHECK(readsIn(9, 11, 9, 11));
+  CHECK(Iono.pinMode(D10, OUTPUT_PP));
+  reads(REG_OL, 1000);
+  CHECK(readsIn(0, 0, 0, 0));
+
+  // disabled groups are not polled
+  CHECK(Iono.diagPollSet(IONO_DIAG_OV, 0, 2));
+  reads(REG_OV, 1000);
+  CHECK(readsIn(0, 0, 0, 0));
+  CHECK(Iono.diagPollSet(IONO_DIAG_OV, 100, 2));
+
+  // a new open-load fault: periods divided by 4 for 2 seconds, then back
+  // to normal although the fault is still active
+  CHECK(Iono.pinMode(D2, OUTPUT_HS, true));
+  run(1000);
+  IonoSim::max14912[0].rt[REG_OL] = 0x02;
+  run(100);
+  reads(REG_THSD, 1000);
+  CHECK(readsIn(70, 84, 70, 84));
+  run(1000);
+  reads(REG_THSD, 1000);
+  CHECK(readsIn(19, 21, 19, 21));
+  reads(REG_THSD, 5000);
+  CHECK(readsIn(99, 101, 99, 101));
+
+  // another fault restarts it
+  IonoSim::max22190[1].reg[MAX22190_REG_FAULT1] = 0x08;
+  run(200);
+  reads(REG_THSD, 1000);
+  CHECK(readsIn(70, 84, 70, 84));
+  IonoSim::max14912[0].rt[REG_OL] = 0;
+  IonoSim::max22190[1].reg[MAX22190_REG_FAULT1] = 0;
+  run(2000);
+  reads(REG_THSD, 1000);
+  CHECK(readsIn(19, 21, 19, 21));
+
+  TEST_END();
+}
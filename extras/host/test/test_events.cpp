@@ -0,0 +1,137 @@
+/*
+  test_events.cpp - Input events queue, debounce and overflow
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+int main() {
+  IonoD16Event ev[8];
+  unsigned long ts;
+
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D16; p++) {
+    CHECK(Iono.pinMode(p, INPUT));
+  }
+  run(10);
+  Iono.eventsEnable(true);
+
+  // no debounce: each change, with the timestamp of its sample
+  IonoSim::inputWrite(D3, true);
+  ts = micros();
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].pin == D3 && ev[0].value == HIGH && ev[0].ts == ts);
+  IonoSim::inputWrite(D3, false);
+  run(1);
+  IonoSim::inputWrite(D3, true);
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 2);
+  CHECK(ev[0].value == LOW && ev[1].value == HIGH && ev[1].seq == ev[0].seq + 1);
+
+  // debounced: shorter pulses dropped, the event is queued after the
+  // debounce time with the timestamp of the first sample
+  Iono.eventsDebounceSet(5);
+  IonoSim::inputWrite(D3, false);
+  run(3);
+  IonoSim::inputWrite(D3, true);
+  run(10);
+  CHECK(Iono.eventsRead(ev, 8) == 0);
+  IonoSim::inputWrite(D3, false);
+  ts = micros();
+  run(5);
+  CHECK(Iono.eventsRead(ev, 8) == 0);
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].pin == D3 && ev[0].value == LOW && ev[0].ts == ts);
+
+  // a bounce restarts the debounce time
+  IonoSim::inputWrite(D3, true);
+  run(3);
+  IonoSim::inputWrite(D3, false);
+  run(1);
+  IonoSim::inputWrite(D3, true);
+  ts = micros();
+  run(5);
+  CHECK(Iono.eventsRead(ev, 8) == 0);
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].value == HIGH && ev[0].ts == ts);
+
+  // DT pins too
+  IonoSim::pins[DT2] = HIGH;
+  run(3);
+  IonoSim::pins[DT2] = LOW;
+  run(10);
+  CHECK(Iono.eventsRead(ev, 8) == 0);
+  IonoSim::pins[DT2] = HIGH;
+  run(10);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].pin == DT2 && ev[0].value == HIGH);
+
+  // overflow: the changes not fitting the queue are counted as lost and
+  // their sequence numbers skipped
+  IonoD16Event all[IONO_EVENT_QUEUE_LEN + 1];
+  Iono.eventsDebounceSet(0);
+  CHECK(Iono.eventsLost() == 0);
+  uint32_t seq = ev[0].seq + 1;
+  bool level = false;
+  for (int i = 0; i < IONO_EVENT_QUEUE_LEN + 10; i++) {
+    level = !level;
+    IonoSim::inputWrite(D5, level);
+    run(1);
+  }
+  CHECK(Iono.eventsLost() == 10);
+  CHECK(Iono.eventsRead(all, IONO_EVENT_QUEUE_LEN + 1) == IONO_EVENT_QUEUE_LEN);
+  for (int i = 0; i < IONO_EVENT_QUEUE_LEN; i++) {
+    CHECK(all[i].pin == D5 && all[i].seq == seq + i);
+    CHECK(all[i].value == (i % 2 == 0 ? HIGH : LOW));
+  }
+  level = !level;
+  IonoSim::inputWrite(D5, level);
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].seq == seq + IONO_EVENT_QUEUE_LEN + 10);
+  CHECK(Iono.eventsLost() == 10);
+
+  // several changes in the same cycle with a single free slot: the
+  // lowest pin is queued
+  for (int i = 0; i < IONO_EVENT_QUEUE_LEN - 1; i++) {
+    level = !level;
+    IonoSim::inputWrite(D5, level);
+    run(1);
+  }
+  IonoSim::inputWrite(D7, true);
+  IonoSim::inputWrite(D9, true);
+  IonoSim::pins[DT4] = HIGH;
+  run(1);
+  CHECK(Iono.eventsLost() == 12);
+  CHECK(Iono.eventsRead(all, IONO_EVENT_QUEUE_LEN + 1) == IONO_EVENT_QUEUE_LEN);
+  CHECK(all[IONO_EVENT_QUEUE_LEN - 1].pin == D7);
+  CHECK(all[IONO_EVENT_QUEUE_LEN - 1].seq == all[IONO_EVENT_QUEUE_LEN - 2].seq + 1);
+  IonoSim::inputWrite(D7, false);
+  run(1);
+  CHECK(Iono.eventsRead(ev, 8) == 1);
+  CHECK(ev[0].pin == D7 && ev[0].seq == all[IONO_EVENT_QUEUE_LEN - 1].seq + 3);
+
+  TEST_END();
+}
@@ -0,0 +1,144 @@
+/*
+  test_faults.cpp - Latched faults read and clear, snapshot consistency
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define REG_WB 0x00
+
+// Wire-break of D1 ... D8, bit 0 = D1
+static void wireBreak(uint8_t bits) {
+  uint8_t reg = 0;
+  for (int i = 0; i < 8; i++) {
+    if ((bits >> i) & 1) {
+      reg |= 0x80 >> i;
+    }
+  }
+  IonoSim::max22190[0].reg[REG_WB] = reg;
+}
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// Reads and clears from within a process() cycle, after the inputs
+// were sampled, as the other core may do
+static bool _hookArmed;
+static IonoD16Snapshot _hookSnap;
+
+static void frameHook(int cs) {
+  if (_hookArmed && (cs == IONO_PIN_CS_DOL || cs == IONO_PIN_CS_DOH)) {
+    _hookArmed = false;
+    Iono.faultsReadClear(&_hookSnap);
+  }
+}
+
+// Latest image published before the cycle of the hook
+static IonoD16Snapshot _prevSnap;
+
+static void runHook() {
+  _hookArmed = true;
+  for (int i = 0; i < 100 && _hookArmed; i++) {
+    Iono.snapshotRead(&_prevSnap);
+    run(1);
+  }
+  CHECK(!_hookArmed);
+}
+
+int main() {
+  IonoD16Snapshot s;
+
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D16; p++) {
+    CHECK(Iono.pinMode(p, INPUT));
+  }
+  run(10);
+  Iono.faultsReadClear(&s);
+  CHECK(s.wireBreak == 0);
+
+  // a transient fault is latched, reported and cleared once
+  wireBreak(0x05);
+  run(2);
+  wireBreak(0);
+  run(2);
+  CHECK(Iono.wireBreakRead(D1) == HIGH);
+  CHECK(Iono.wireBreakRead(D1) == LOW);
+  CHECK(Iono.faultsReadClearType(IONO_FAULT_WB, 0xffff) == 0x0004);
+  CHECK(Iono.faultsReadClearType(IONO_FAULT_WB, 0xffff) == 0);
+  run(2);
+  Iono.snapshotRead(&s);
+  CHECK(s.wireBreak == 0);
+
+  // cleared however many cycles after it was latched
+  wireBreak(0x02);
+  run(1);
+  wireBreak(0);
+  run(500);
+  Iono.faultsReadClear(&s);
+  CHECK(s.wireBreak == 0x0002);
+  Iono.snapshotRead(&s);
+  CHECK(s.wireBreak == 0);
+  run(1);
+  Iono.snapshotRead(&s);
+  CHECK(s.wireBreak == 0);
+
+  // only the requested types are cleared
+  wireBreak(0x01);
+  run(1);
+  wireBreak(0);
+  run(1);
+  Iono.faultsReadClear(&s, 1 << IONO_FAULT_OL);
+  CHECK(s.wireBreak == 0x0001);
+  run(1);
+  Iono.faultsReadClear(&s, 1 << IONO_FAULT_WB);
+  CHECK(s.wireBreak == 0x0001);
+  run(1);
+  Iono.snapshotRead(&s);
+  CHECK(s.wireBreak == 0);
+
+  // read during a cycle: the image is the one published by the previous
+  // cycle, with all its fields from the same cycle
+  IonoSim::frameHook = frameHook;
+  wireBreak(0x10);
+  run(1);
+  IonoSim::inputWrite(D3, true);
+  runHook();
+  CHECK(_hookSnap.seq == _prevSnap.seq);
+  CHECK(_hookSnap.ts == _prevSnap.ts);
+  CHECK(_hookSnap.inputs == _prevSnap.inputs);
+  CHECK(_hookSnap.inputsTs == _prevSnap.inputsTs);
+  CHECK(_hookSnap.outputs == _prevSnap.outputs);
+  CHECK(_hookSnap.wireBreak == 0x0010);
+  Iono.snapshotRead(&s);
+  CHECK(s.seq == _hookSnap.seq + 1);
+  CHECK((s.inputs & 0x0004) != 0);
+
+  // detected again in the cycle after the image was published: kept
+  CHECK(s.wireBreak == 0x0010);
+  wireBreak(0);
+  run(1);
+  Iono.faultsReadClear(&s);
+  CHECK(s.wireBreak == 0x0010);
+  run(1);
+  Iono.snapshotRead(&s);
+  CHECK(s.wireBreak == 0);
+  IonoSim::frameHook = NULL;
+
+  TEST_END();
+}
@@ -0,0 +1,75 @@
+/*
+  test_io.cpp - Inputs, outputs and LED through the simulated chips
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+int main() {
+  CHECK(Iono.setup());
+  run(10);
+  CHECK(Iono.ready());
+
+  CHECK(Iono.pinMode(D1, OUTPUT_HS));
+  CHECK(Iono.pinMode(D16, OUTPUT_PP));
+  CHECK(Iono.pinMode(D5, INPUT));
+  CHECK(Iono.pinMode(D12, INPUT));
+  run(10);
+
+  CHECK(Iono.write(D1, HIGH));
+  CHECK(Iono.write(D16, HIGH));
+  run(10);
+  CHECK(IonoSim::outputRead(D1));
+  CHECK(IonoSim::outputRead(D16));
+  CHECK(!IonoSim::outputRead(D2));
+  CHECK(Iono.read(D1) == HIGH);
+
+  CHECK(Iono.write(D1, LOW));
+  run(10);
+  CHECK(!IonoSim::outputRead(D1));
+  CHECK(Iono.read(D1) == LOW);
+
+  CHECK(Iono.read(D5) == LOW);
+  CHECK(Iono.read(D12) == LOW);
+  IonoSim::inputWrite(D5, true);
+  IonoSim::inputWrite(D12, true);
+  run(10);
+  CHECK(Iono.read(D5) == HIGH);
+  CHECK(Iono.read(D12) == HIGH);
+  IonoSim::inputWrite(D12, false);
+  run(10);
+  CHECK(Iono.read(D12) == LOW);
+
+  Iono.ledSet(true);
+  run(2);
+  CHECK(IonoSim::led);
+  Iono.ledSet(false);
+  run(2);
+  CHECK(!IonoSim::led);
+
+  for (int i = 0; i < 2; i++) {
+    CHECK(IonoSim::max22190[i].crcErrors == 0);
+    CHECK(IonoSim::max14912[i].crcErrors == 0);
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,116 @@
+/*
+  test_link.cpp - Links list updates and slots allocation
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+int main() {
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D8; p++) {
+    CHECK(Iono.pinMode(p, INPUT));
+    CHECK(Iono.pinMode(p + 8, OUTPUT_HS));
+  }
+  run(10);
+
+  CHECK(!Iono.link(0, D9, LINK_FOLLOW, 0));
+  CHECK(!Iono.link(D1, D16 + 1, LINK_FOLLOW, 0));
+  CHECK(!Iono.link(D1, D9, LINK_FLIP_T + 1, 0));
+  CHECK(Iono.link(D1, D9, LINK_NONE, 0));
+
+  CHECK(Iono.link(D1, D9, LINK_FOLLOW, 0));
+  IonoSim::inputWrite(D1, true);
+  run(2);
+  CHECK(IonoSim::outputRead(D9));
+
+  // replaced, applied to the current input state
+  CHECK(Iono.link(D1, D9, LINK_INVERT, 0));
+  run(2);
+  CHECK(!IonoSim::outputRead(D9));
+  IonoSim::inputWrite(D1, false);
+  run(2);
+  CHECK(IonoSim::outputRead(D9));
+
+  CHECK(Iono.link(D1, D9, LINK_NONE, 0));
+  IonoSim::inputWrite(D1, true);
+  run(2);
+  CHECK(IonoSim::outputRead(D9));
+
+  // one slot for each pair of distinct pins
+  CHECK(!Iono.link(D1, D1, LINK_FOLLOW, 0));
+  int n = 0;
+  for (int in = D1; in <= D16; in++) {
+    for (int out = D1; out <= D16; out++) {
+      if (out != in && Iono.link(in, out, out >= D9 && out <= D13 ? LINK_FOLLOW : LINK_NONE, 10)) {
+        n++;
+      }
+    }
+  }
+  CHECK(n == 16 * 15);
+  for (int in = D1; in <= D16; in++) {
+    for (int out = D1; out <= D16; out++) {
+      if (out != in && (out < D9 || out > D13)) {
+        CHECK(Iono.link(in, out, LINK_FOLLOW, 10));
+      }
+    }
+  }
+
+  // replaced in place with all the slots in use
+  CHECK(Iono.link(D1, D9, LINK_INVERT, 10));
+  CHECK(Iono.link(D1, D9, LINK_FOLLOW, 10));
+
+  // a removed slot is reused only after a process() cycle
+  CHECK(Iono.link(D8, D12, LINK_NONE, 0));
+  CHECK(!Iono.link(D8, D12, LINK_FOLLOW, 0));
+  run(1);
+  CHECK(Iono.link(D8, D12, LINK_FOLLOW, 0));
+
+  // only D1 drives D9 ... D13 from here on
+  for (int in = D2; in <= D16; in++) {
+    for (int out = D9; out <= D13; out++) {
+      if (out != in) {
+        CHECK(Iono.link(in, out, LINK_NONE, 0));
+      }
+    }
+  }
+  for (int in = D1; in <= D16; in++) {
+    for (int out = D1; out <= D16; out++) {
+      if (out != in && (out < D9 || out > D13)) {
+        CHECK(Iono.link(in, out, LINK_NONE, 0));
+      }
+    }
+  }
+
+  // the list of D1 is intact after the updates: D9 ... D12, D13
+  IonoSim::inputWrite(D1, false);
+  run(20);
+  for (int out = D9; out <= D13; out++) {
+    CHECK(!IonoSim::outputRead(out));
+  }
+  IonoSim::inputWrite(D1, true);
+  run(20);
+  for (int out = D9; out <= D13; out++) {
+    CHECK(IonoSim::outputRead(out));
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,130 @@
+/*
+  test_modbus_bus.cpp - Modbus example, staged outputs applied by
+  several units sharing a virtual RS-485 bus, apply skew across units
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <stdlib.h>
+#include "modbus.h"
+#include "test.h"
+
+#define UNITS 20
+#define STEP_US 10
+#define OUTPUTS_STAGED 0x5aa5
+
+// Each unit is a child process running the sketch on its own simulated
+// board. All the units get the same master frames at the same bus
+// times, byte by byte at the baud rate; their loop() runs with a period
+// and phase of its own, standing for the different loads of the units.
+// The child prints the time its outputs switched, from the end of the
+// commit frame
+
+static unsigned long _loopPeriodUs(int unit) {
+  return 100 + (unit * 137) % 900;
+}
+
+static unsigned long _latePeriods(word delayMs) {
+  return delayMs == 0 ? 2 : 3;
+}
+
+static uint16_t outputs() {
+  uint16_t o = 0;
+  for (int p = D1; p <= D16; p++) {
+    if (IonoSim::outputRead(p)) {
+      o |= 1 << (p - D1);
+    }
+  }
+  return o;
+}
+
+static int unitRun(int unit, word delayMs) {
+  unsigned long charUs = 11000000ul / 19200;
+  unsigned long loopUs = _loopPeriodUs(unit);
+  mbStart(NULL, unit);
+
+  // broadcast: stage, then commit with the delay
+  std::vector<struct mbBusFrameStr> frames = {
+    {1000, mbFrame(0, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS_STAGED, OUTPUTS_STAGED}))},
+    {20000, mbFrame(0, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS_COMMIT, delayMs}))},
+  };
+  unsigned long commitEndUs = frames[1].startUs + frames[1].bytes.size() * charUs;
+
+  long t = mbBusRun(frames, 19200, loopUs, (unit * 71) % loopUs, STEP_US, commitEndUs + delayMs * 1000ul + 20000,
+      [](unsigned long t) { return outputs() == OUTPUTS_STAGED; });
+  if (t < 0) {
+    return 1;
+  }
+  printf("%ld\n", (long) (t - commitEndUs));
+  return 0;
+}
+
+static long unitApplyUs(const char* self, int unit, word delayMs) {
+  char cmd[256];
+  char line[64];
+  long us = -1;
+  snprintf(cmd, sizeof(cmd), "\"%s\" %d %u", self, unit, delayMs);
+  FILE* f = popen(cmd, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    us = atol(line);
+  }
+  if (pclose(f) != 0) {
+    return -1;
+  }
+  return us;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    return unitRun(atoi(argv[1]), atoi(argv[2]));
+  }
+
+  const word delays[] = {0, 10};
+  unsigned long t35Us = 38500000ul / 19200;
+  for (word delayMs : delays) {
+    long min = -1;
+    long max = -1;
+    unsigned long loopMaxUs = 0;
+    for (int unit = 1; unit <= UNITS; unit++) {
+      long us = unitApplyUs(argv[0], unit, delayMs);
+      CHECK(us >= 0);
+      if (us < 0) {
+        continue;
+      }
+      // the end of the frame is detected 3.5 characters after the last
+      // byte is read by loop(), up to a period late, and at a loop()
+      // run, up to another period late; the delayed apply is polled by
+      // loop() too
+      long earliest = t35Us + delayMs * 1000l;
+      CHECK(us >= earliest);
+      CHECK(us <= earliest + (long) (_latePeriods(delayMs) * _loopPeriodUs(unit) + 2 * STEP_US));
+      if (min < 0 || us < min) {
+        min = us;
+      }
+      if (us > max) {
+        max = us;
+      }
+      if (_loopPeriodUs(unit) > loopMaxUs) {
+        loopMaxUs = _loopPeriodUs(unit);
+      }
+    }
+    printf("delay %u ms: %d units applied in %ld ... %ld us from the commit frame, skew %ld us, max loop period %lu us\n",
+        delayMs, UNITS, min, max, max - min, loopMaxUs);
+    // bound by the loop period of the slowest unit
+    CHECK(max - min <= (long) (_latePeriods(delayMs) * loopMaxUs + 2 * STEP_US));
+  }
+
+  TEST_END();
+}
@@ -0,0 +1,103 @@
+/*
+  test_modbus_cfg.cpp - Modbus example, pin modes and joins applied at
+  start-up, configuration ranges, latched faults clear
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "modbus.h"
+#include "test.h"
+
+#define MAX14912_REG_WD_JN 3
+#define JOIN_LOW 0x04
+#define JOIN_HIGH 0x08
+#define MAX22190_REG_WB 0x00
+
+int main() {
+  // D1-D2 can't be joined with D3 push-pull, D5-D6 and D13-D14 can
+  const word modes[16] = {
+    3, 5, 6, 3,
+    3, 5, 1, 2,
+    3, 3, 3, 3,
+    4, 5, 3, 3
+  };
+  mbStart(modes);
+
+  // only the invalid join is dropped, D2 stays an output
+  CHECK(IonoSim::max14912[0].reg[MAX14912_REG_WD_JN] == JOIN_HIGH);
+  CHECK(IonoSim::max14912[1].reg[MAX14912_REG_WD_JN] == JOIN_HIGH);
+  CHECK(Iono.pinModeRead(D2) == OUTPUT_HS);
+  CHECK(Iono.pinModeRead(D3) == OUTPUT_PP);
+  CHECK(Iono.pinModeRead(D14) == OUTPUT_HS);
+  CHECK(_outputsMask == 0xff3f);
+  CHECK((mbRead(MB_FC_READ_INPUT_REGISTER, 1111) & MB_DIAG_ERR_CONFIG) == 0);
+  CHECK(mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0xffff})).size() == 5);
+  mbRun(2);
+  CHECK(mbReadHolding(MB_REG_OUTPUTS) == 0xff3f);
+
+  // link configuration range
+  word linkD1 = MB_REG_CFG_START + MB_REG_CFG_OFFSET_LINK_D1;
+  CHECK(mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({linkD1, 17})) ==
+      Pdu({MB_FC_WRITE_SINGLE_REGISTER | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  CHECK(mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({linkD1, 0xffff})) ==
+      Pdu({MB_FC_WRITE_SINGLE_REGISTER | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  CHECK(mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({linkD1, 16})).size() == 5);
+  CHECK(mbReadHolding(linkD1) == 16);
+  CHECK(mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({linkD1, 0})).size() == 5);
+  CHECK(mbReadHolding(linkD1) == 0);
+
+  // a wire-break on D7 read long after it was latched is cleared by
+  // reading 1203, and reported once
+  IonoSim::max22190[0].reg[MAX22190_REG_WB] = 0x02;
+  mbRun(2);
+  IonoSim::max22190[0].reg[MAX22190_REG_WB] = 0;
+  mbRun(500);
+  CHECK(mbRead(MB_FC_READ_INPUT_REGISTER, 1103) == 0x0040);
+  CHECK(mbRead(MB_FC_READ_INPUT_REGISTER, 1203) == 0x0040);
+  CHECK(mbRead(MB_FC_READ_INPUT_REGISTER, 1203) == 0);
+  mbRun(2);
+  CHECK(mbRead(MB_FC_READ_INPUT_REGISTER, 1103) == 0);
+
+  // same reading the discrete inputs
+  IonoSim::max22190[0].reg[MAX22190_REG_WB] = 0x02;
+  mbRun(2);
+  IonoSim::max22190[0].reg[MAX22190_REG_WB] = 0;
+  mbRun(500);
+  Pdu r = mbRequest(MB_TEST_UNIT, MB_FC_READ_DISCRETE_INPUTS, mbWords({107, 1}));
+  CHECK(r == Pdu({MB_FC_READ_DISCRETE_INPUTS, 1, 1}));
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_DISCRETE_INPUTS, mbWords({107, 1}));
+  CHECK(r == Pdu({MB_FC_READ_DISCRETE_INPUTS, 1, 0}));
+
+  // corrupted answers: setup() makes a single configure() attempt, as
+  // many frames as a direct call, reports the failure in the error word
+  // and the output word keeps the modes in place
+  const word outputs[16] = {3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3};
+  IonoD16PinConfig cfg[16];
+  for (int i = 0; i < 16; i++) {
+    cfg[i] = {OUTPUT_HS, false, false};
+  }
+  IonoSim::spiBitErrors(0, 1);
+  uint32_t frames = IonoSim::max14912[0].frames;
+  CHECK(!Iono.configure(cfg));
+  uint32_t attempt = IonoSim::max14912[0].frames - frames;
+  mbConfig(outputs);
+  frames = IonoSim::max14912[0].frames;
+  setup();
+  CHECK(IonoSim::max14912[0].frames - frames == attempt);
+  IonoSim::spiBitErrors(0, 0);
+  CHECK(Iono.pinModeRead(D7) == INPUT);
+  CHECK(_outputsMask == 0xff3f);
+  mbRun(2);
+  CHECK((mbRead(MB_FC_READ_INPUT_REGISTER, 1111) & MB_DIAG_ERR_CONFIG) != 0);
+
+  TEST_END();
+}
@@ -0,0 +1,223 @@
+/*
+  test_modbus_fc.cpp - Modbus example, RTU framing and request
+  checks, frames of the output word functions 6, 16, 22, 23, of the
+  staged outputs and of the events FIFO function 24
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "modbus.h"
+#include "test.h"
+
+static uint16_t outputs() {
+  uint16_t o = 0;
+  for (int p = D1; p <= D16; p++) {
+    if (IonoSim::outputRead(p)) {
+      o |= 1 << (p - D1);
+    }
+  }
+  return o;
+}
+
+int main() {
+  Pdu r;
+  Pdu pdu;
+  // D1 ... D4 inputs, the rest high-side outputs
+  const word modes[16] = {1, 1, 1, 1};
+  mbStart(modes);
+  CHECK(_outputsMask == 0xfff0);
+
+  // FC6 and FC16, the input bits are ignored
+  r = mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x00ff}));
+  CHECK(r == Pdu({MB_FC_WRITE_SINGLE_REGISTER, 0x05, 0x79, 0x00, 0xff}));
+  CHECK(outputs() == 0x00f0);
+  pdu = mbWords({MB_REG_OUTPUTS, 1});
+  pdu.push_back(2);
+  pdu.push_back(0x0f);
+  pdu.push_back(0x0f);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_WRITE_MULTIPLE_REGISTERS, 0x05, 0x79, 0x00, 0x01}));
+  CHECK(outputs() == 0x0f00);
+  CHECK(mbReadHolding(MB_REG_OUTPUTS) == 0x0f00);
+
+  // FC22: set D5, clear D9, input bits in both masks are ignored
+  r = mbRequest(MB_TEST_UNIT, MB_FC_MASK_WRITE_REGISTER, mbWords({MB_REG_OUTPUTS, 0xfee0, 0x001f}));
+  CHECK(r == Pdu({MB_FC_MASK_WRITE_REGISTER, 0x05, 0x79, 0xfe, 0xe0, 0x00, 0x1f}));
+  CHECK(outputs() == 0x0e10);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_MASK_WRITE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x0000, 0xffff}));
+  CHECK(r.size() == 7 && r[0] == MB_FC_MASK_WRITE_REGISTER);
+  CHECK(outputs() == 0xfff0);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_MASK_WRITE_REGISTER, mbWords({MB_REG_OUTPUTS + 1, 0x0000, 0x0000}));
+  CHECK(r == Pdu({MB_FC_MASK_WRITE_REGISTER | 0x80, MB_EX_ILLEGAL_DATA_ADDRESS}));
+  CHECK(outputs() == 0xfff0);
+
+  // FC23: the read part returns the snapshot of the last process()
+  // cycle, run before the write
+  pdu = mbWords({MB_REG_OUTPUTS, 1, MB_REG_OUTPUTS, 1});
+  pdu.push_back(2);
+  pdu.push_back(0x12);
+  pdu.push_back(0x34);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_READ_WRITE_MULTIPLE_REGISTERS, 2, 0xff, 0xf0}));
+  CHECK(outputs() == 0x1230);
+  CHECK(mbReadHolding(MB_REG_OUTPUTS) == 0x1230);
+
+  // FC23 with an invalid read range writes nothing
+  pdu = mbWords({1, 1, MB_REG_OUTPUTS, 1});
+  pdu.push_back(2);
+  pdu.push_back(0);
+  pdu.push_back(0);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_READ_WRITE_MULTIPLE_REGISTERS | 0x80, MB_EX_ILLEGAL_DATA_ADDRESS}));
+  CHECK(outputs() == 0x1230);
+
+  // FC23 and FC16 with a byte count not matching the write quantity
+  // are rejected before anything is written
+  pdu = mbWords({MB_REG_OUTPUTS, 1, MB_REG_OUTPUTS, 1});
+  pdu.push_back(4);
+  pdu.insert(pdu.end(), {0x00, 0x00, 0x00, 0x00});
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_READ_WRITE_MULTIPLE_REGISTERS | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  pdu = mbWords({MB_REG_OUTPUTS, 1, MB_REG_OUTPUTS, 2});
+  pdu.push_back(2);
+  pdu.insert(pdu.end(), {0x00, 0x00});
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_READ_WRITE_MULTIPLE_REGISTERS | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  pdu = mbWords({MB_REG_OUTPUTS, 1});
+  pdu.push_back(1);
+  pdu.insert(pdu.end(), {0x00, 0x00});
+  r = mbRequest(MB_TEST_UNIT, MB_FC_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_WRITE_MULTIPLE_REGISTERS | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  CHECK(outputs() == 0x1230);
+
+  // FC22 with a missing OR mask, unsupported function code
+  r = mbRequest(MB_TEST_UNIT, MB_FC_MASK_WRITE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x0000}));
+  CHECK(r == Pdu({MB_FC_MASK_WRITE_REGISTER | 0x80, MB_EX_ILLEGAL_DATA_VALUE}));
+  r = mbRequest(MB_TEST_UNIT, 8, mbWords({0, 0}));
+  CHECK(r == Pdu({8 | 0x80, MB_EX_ILLEGAL_FUNCTION}));
+  CHECK(outputs() == 0x1230);
+
+  // a frame is only handled after 3.5 characters of silence, a pause
+  // that long splits it and both parts are dropped on the CRC
+  std::vector<byte> frame = mbFrame(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0}));
+  IONO_RS485.tx.clear();
+  IONO_RS485.rx.assign(frame.begin(), frame.begin() + 4);
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us - 1);
+  modbusProcess();
+  IONO_RS485.rx.assign(frame.begin() + 4, frame.end());
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us - 1);
+  modbusProcess();
+  CHECK(IONO_RS485.tx.empty());
+  IonoSim::advanceUs(1);
+  modbusProcess();
+  CHECK(mbResponse(MB_TEST_UNIT) == Pdu({MB_FC_WRITE_SINGLE_REGISTER, 0x05, 0x79, 0x00, 0x00}));
+  CHECK(IonoSim::pins[IONO_PIN_RS485_TXEN_N] == HIGH);
+  Iono.process();
+  CHECK(outputs() == 0x0000);
+  IONO_RS485.tx.clear();
+  IONO_RS485.rx.assign(frame.begin(), frame.begin() + 4);
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us);
+  modbusProcess();
+  IONO_RS485.rx.assign(frame.begin() + 4, frame.end());
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us);
+  modbusProcess();
+  CHECK(IONO_RS485.tx.empty());
+
+  // corrupted CRC, other unit: no response
+  frame = mbFrame(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x1230}));
+  frame.back() ^= 1;
+  IONO_RS485.rx = frame;
+  modbusProcess();
+  IonoSim::advanceUs(_rtuT35Us);
+  modbusProcess();
+  CHECK(IONO_RS485.tx.empty());
+  r = mbRequest(MB_TEST_UNIT + 1, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x1230}));
+  CHECK(IONO_RS485.tx.empty());
+  Iono.process();
+  CHECK(outputs() == 0x0000);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_WRITE_SINGLE_REGISTER, mbWords({MB_REG_OUTPUTS, 0x1230}));
+  CHECK(outputs() == 0x1230);
+
+  // broadcast FC22: applied, no response
+  r = mbRequest(0, MB_FC_MASK_WRITE_REGISTER, mbWords({MB_REG_OUTPUTS, 0xffff ^ 0x0010, 0x0000}));
+  CHECK(r.empty());
+  CHECK(outputs() == 0x1220);
+
+  // staged outputs, applied 5 ms after the request is handled
+  pdu = mbWords({MB_REG_OUTPUTS_STAGED, 2});
+  pdu.push_back(4);
+  pdu.insert(pdu.end(), {0x00, 0xf0, 0x00, 0x05});
+  r = mbRequest(MB_TEST_UNIT, MB_FC_WRITE_MULTIPLE_REGISTERS, pdu);
+  CHECK(r == Pdu({MB_FC_WRITE_MULTIPLE_REGISTERS, 0x05, 0x7a, 0x00, 0x02}));
+  mbRun(4);
+  CHECK(outputs() == 0x1220);
+  mbRun(2);
+  CHECK(outputs() == 0x00f0);
+
+  // FC24: byte count, FIFO count, then 4 registers per event. The
+  // output changes above are read back as input events
+  Pdu fifo = mbWords({MB_REG_EV_START});
+  mbRun(EV_DEBOUNCE_MS + 5);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, fifo);
+  while (r.size() > 5 && r[4] != 0) {
+    r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, fifo);
+  }
+  CHECK(r == Pdu({MB_FC_READ_FIFO_QUEUE, 0x00, 0x02, 0x00, 0x00}));
+
+  // changes shorter than EV_DEBOUNCE_MS are not recorded
+  IonoSim::inputWrite(D2, true);
+  mbRun(EV_DEBOUNCE_MS - 5);
+  IonoSim::inputWrite(D2, false);
+  mbRun(EV_DEBOUNCE_MS + 5);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, fifo);
+  CHECK(r == Pdu({MB_FC_READ_FIFO_QUEUE, 0x00, 0x02, 0x00, 0x00}));
+  IonoSim::inputWrite(D2, true);
+  mbRun(EV_DEBOUNCE_MS + 5);
+  IonoSim::inputWrite(D3, true);
+  mbRun(EV_DEBOUNCE_MS + 5);
+
+  // events handled but not transmitted are returned again
+  _modbusOnRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, MB_REG_EV_START, 0, NULL);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, fifo);
+  CHECK(r.size() == 1 + 4 + 16);
+  CHECK(r.size() > 20 && r[1] == 0 && r[2] == 18 && r[3] == 0 && r[4] == 8);
+  CHECK(r.size() > 20 && r[5] == D2 && r[6] == 1 && r[13] == D3 && r[14] == 1);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, fifo);
+  CHECK(r == Pdu({MB_FC_READ_FIFO_QUEUE, 0x00, 0x02, 0x00, 0x00}));
+
+  // same with function 4
+  IonoSim::inputWrite(D2, false);
+  mbRun(EV_DEBOUNCE_MS + 5);
+  _modbusOnRequest(MB_TEST_UNIT, MB_FC_READ_INPUT_REGISTER, MB_REG_EV_START, MB_EV_WORDS, NULL);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_INPUT_REGISTER, mbWords({MB_REG_EV_START, MB_EV_WORDS * 2}));
+  CHECK(r.size() == 2 + 16);
+  CHECK(r.size() > 17 && r[2] == D2 && r[3] == 0 && r[10] == 0 && r[11] == 0);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_FIFO_QUEUE, mbWords({MB_REG_EV_START + 1}));
+  CHECK(r == Pdu({MB_FC_READ_FIFO_QUEUE | 0x80, MB_EX_ILLEGAL_DATA_ADDRESS}));
+
+  // each Wiegand interface set up on the first read of its registers
+  CHECK(Iono.wiegandAvailable(DT1) == -1);
+  CHECK(Iono.wiegandAvailable(DT3) == -1);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_INPUT_REGISTER, mbWords({4001, 1}));
+  CHECK(r == Pdu({MB_FC_READ_INPUT_REGISTER, 0x02, 0x00, 0x00}));
+  CHECK(Iono.wiegandAvailable(DT1) == 0);
+  CHECK(Iono.wiegandAvailable(DT3) == -1);
+  r = mbRequest(MB_TEST_UNIT, MB_FC_READ_INPUT_REGISTER, mbWords({5100, 1}));
+  CHECK(r == Pdu({MB_FC_READ_INPUT_REGISTER, 0x02, 0x00, 0x00}));
+  CHECK(Iono.wiegandAvailable(DT3) == 0);
+
+  TEST_END();
+}
@@ -0,0 +1,114 @@
+/*
+  test_outputs.cpp - Verified outputs refresh and watchdog keep-alive
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+// Longest interval without frames to each MAX14912
+static unsigned long _frameTs[2];
+static unsigned long _frameGapMaxUs[2];
+
+static void frameHook(int cs) {
+  int i = cs == IONO_PIN_CS_DOL ? 0 : (cs == IONO_PIN_CS_DOH ? 1 : -1);
+  if (i < 0) {
+    return;
+  }
+  if (micros() - _frameTs[i] > _frameGapMaxUs[i]) {
+    _frameGapMaxUs[i] = micros() - _frameTs[i];
+  }
+  _frameTs[i] = micros();
+}
+
+static void gapReset() {
+  for (int i = 0; i < 2; i++) {
+    _frameTs[i] = micros();
+    _frameGapMaxUs[i] = 0;
+  }
+}
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+int main() {
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D16; p++) {
+    CHECK(Iono.pinMode(p, OUTPUT_PP));
+  }
+  CHECK(Iono.write(D2, HIGH));
+  CHECK(Iono.write(D10, HIGH));
+  run(200);
+  CHECK(Iono.outputsMismatchCount() == 0);
+
+  // a corrupted state is re-written at the next verification
+  IonoSim::max14912[0].reg[0] ^= 0x81;
+  IonoSim::max14912[1].reg[0] = 0;
+  run(101);
+  CHECK(IonoSim::outputRead(D1) == LOW && IonoSim::outputRead(D2) == HIGH);
+  CHECK(IonoSim::outputRead(D8) == LOW && IonoSim::outputRead(D10) == HIGH);
+  CHECK(Iono.outputsMismatchCount() == 2);
+  run(300);
+  CHECK(Iono.outputsMismatchCount() == 2);
+
+  // armed by setup(), each peripheral is addressed within the keep-alive
+  // interval, even with no polling and nothing else sent to it
+  CHECK(IonoSim::pins[IONO_PIN_MAX14912_WD_EN] == HIGH);
+  IonoSim::frameHook = frameHook;
+  for (int k = 0; k < 2; k++) {
+    gapReset();
+    run(1000);
+    for (int i = 0; i < 2; i++) {
+      CHECK(_frameGapMaxUs[i] > 0);
+      CHECK(_frameGapMaxUs[i] <= (IONO_OUTPUTS_KEEPALIVE_MS + 1) * 1000ul);
+    }
+    for (int d = IONO_DIAG_FAULT; d <= IONO_DIAG_THSD; d++) {
+      CHECK(Iono.diagPollSet(d, 0, 0));
+    }
+  }
+  Iono.outputsWatchdog(50);
+  gapReset();
+  run(1000);
+  for (int i = 0; i < 2; i++) {
+    CHECK(_frameGapMaxUs[i] > (IONO_OUTPUTS_KEEPALIVE_MS + 1) * 1000ul);
+    CHECK(_frameGapMaxUs[i] <= 51 * 1000ul);
+  }
+
+  // disarmed, no polling: nothing sent until the outputs change
+  Iono.outputsWatchdog(0);
+  CHECK(IonoSim::pins[IONO_PIN_MAX14912_WD_EN] == LOW);
+  uint32_t frames = IonoSim::max14912[0].frames + IonoSim::max14912[1].frames;
+  IonoSim::max14912[1].reg[0] ^= 0x10;
+  run(1000);
+  CHECK(IonoSim::max14912[0].frames + IonoSim::max14912[1].frames == frames);
+  CHECK(IonoSim::outputRead(D13) == HIGH);
+
+  // the refresh interval verifies the state regardless of the polling
+  Iono.outputsRefresh(10);
+  run(11);
+  CHECK(IonoSim::outputRead(D13) == LOW && IonoSim::outputRead(D10) == HIGH);
+  CHECK(Iono.outputsMismatchCount() == 3);
+  Iono.outputsRefresh(0);
+
+  frames = IonoSim::max14912[0].frames;
+  CHECK(Iono.write(D3, HIGH));
+  CHECK(IonoSim::max14912[0].frames > frames);
+  CHECK(IonoSim::outputRead(D3) == HIGH);
+
+  TEST_END();
+}
@@ -0,0 +1,160 @@
+/*
+  test_prof.cpp - process() phases profiler: counts, attribution of the
+  time to the phases, reset
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoSim.h"
+#include "test.h"
+
+#define private public
+#include "IonoD16.h"
+#undef private
+
+// Time of a phase not run in the cycle
+#define NONE 0xffffffff
+
+// Time taken by each frame to the inputs and to the outputs peripherals
+#define IN_FRAME_US 100
+#define OUT_FRAME_US 1000
+
+static void frameHook(int cs) {
+  if (cs == IONO_PIN_CS_DIL || cs == IONO_PIN_CS_DIH) {
+    IonoSim::advanceUs(IN_FRAME_US);
+  } else {
+    IonoSim::advanceUs(OUT_FRAME_US);
+  }
+}
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// Sum of the times of the phases, excluding the whole cycle
+static unsigned long phasesSumUs() {
+  unsigned long sum = 0;
+  for (int p = 0; p < IONO_PHASE_CYCLE; p++) {
+    sum += Iono._prof[p].sumUs;
+  }
+  return sum;
+}
+
+int main() {
+  IonoD16PhaseStats st[IONO_PHASE_NUM];
+
+  // accounting: phases not run skipped, min/avg/max, reset applied by
+  // the next update
+  unsigned long a[IONO_PHASE_NUM] = {10, 20, 30, NONE, NONE, 60};
+  unsigned long b[IONO_PHASE_NUM] = {NONE, 5, 40, NONE, 7, 52};
+  unsigned long c[IONO_PHASE_NUM] = {12, 35, 30, NONE, NONE, 77};
+  Iono._profUpdate(a);
+  Iono._profUpdate(b);
+  Iono._profUpdate(c);
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_INPUTS].count == 2);
+  CHECK(st[IONO_PHASE_INPUTS].minUs == 10);
+  CHECK(st[IONO_PHASE_INPUTS].avgUs == 11);
+  CHECK(st[IONO_PHASE_INPUTS].maxUs == 12);
+  CHECK(st[IONO_PHASE_DIAG].count == 3);
+  CHECK(st[IONO_PHASE_DIAG].minUs == 5);
+  CHECK(st[IONO_PHASE_DIAG].avgUs == 20);
+  CHECK(st[IONO_PHASE_DIAG].maxUs == 35);
+  CHECK(st[IONO_PHASE_LINK].minUs == 30);
+  CHECK(st[IONO_PHASE_LINK].maxUs == 40);
+  CHECK(st[IONO_PHASE_PWM].count == 0);
+  CHECK(st[IONO_PHASE_PWM].avgUs == 0);
+  CHECK(st[IONO_PHASE_LED].count == 1);
+  CHECK(st[IONO_PHASE_LED].minUs == 7);
+  CHECK(st[IONO_PHASE_LED].maxUs == 7);
+  CHECK(st[IONO_PHASE_CYCLE].count == 3);
+  CHECK(st[IONO_PHASE_CYCLE].avgUs == 63);
+  CHECK((Iono._profLock & 1) == 0);
+  Iono.statsReset();
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_CYCLE].count == 3);
+  Iono._profUpdate(b);
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_INPUTS].count == 0);
+  CHECK(st[IONO_PHASE_DIAG].count == 1);
+  CHECK(st[IONO_PHASE_DIAG].minUs == 5);
+  CHECK(st[IONO_PHASE_CYCLE].count == 1);
+  CHECK(st[IONO_PHASE_CYCLE].maxUs == 52);
+
+  CHECK(Iono.setup());
+  for (int p = D1; p <= D8; p++) {
+    CHECK(Iono.pinMode(p, INPUT));
+    CHECK(Iono.pinMode(p + 8, OUTPUT_PP));
+  }
+  run(100);
+  IonoSim::frameHook = frameHook;
+
+  // every phase counted at each cycle except the LED one, the time of
+  // the SPI frames attributed to the phase sending them
+  Iono.statsReset();
+  run(1000);
+  CHECK(Iono.stats(st));
+  for (int p = 0; p < IONO_PHASE_NUM; p++) {
+    CHECK(st[p].count == (p == IONO_PHASE_LED ? 0 : 1000));
+    CHECK(st[p].minUs <= st[p].avgUs && st[p].avgUs <= st[p].maxUs);
+  }
+  CHECK(st[IONO_PHASE_INPUTS].minUs == 2 * IN_FRAME_US);
+  CHECK(st[IONO_PHASE_INPUTS].maxUs == 2 * IN_FRAME_US);
+  CHECK(st[IONO_PHASE_DIAG].maxUs >= OUT_FRAME_US);
+  CHECK(st[IONO_PHASE_LINK].maxUs == 0);
+  CHECK(st[IONO_PHASE_PWM].maxUs == 0);
+  CHECK(phasesSumUs() == Iono._prof[IONO_PHASE_CYCLE].sumUs);
+
+  // PWM edges and LED changes
+  CHECK(Iono.pwmSet(D9, 100, 0x8000));
+  Iono.statsReset();
+  for (int i = 0; i < 3; i++) {
+    Iono.ledSet(i % 2 != 0);
+    run(100);
+  }
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_LED].count == 3);
+  CHECK(st[IONO_PHASE_PWM].count == 300);
+  CHECK(st[IONO_PHASE_PWM].minUs == 0);
+  CHECK(st[IONO_PHASE_PWM].maxUs == OUT_FRAME_US);
+  CHECK(Iono._prof[IONO_PHASE_PWM].sumUs > 0);
+  CHECK(Iono._prof[IONO_PHASE_PWM].sumUs % OUT_FRAME_US == 0);
+  CHECK(phasesSumUs() == Iono._prof[IONO_PHASE_CYCLE].sumUs);
+  CHECK(Iono.pwmSet(D9, 0, 0));
+  run(10);
+
+  // inputs sampled at a fixed rate, 1ms cycles: counted only when
+  // sampled
+  IonoSim::frameHook = NULL;
+  Iono.inputsSamplingSet(5000);
+  Iono.statsReset();
+  run(1000);
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_INPUTS].count >= 199 && st[IONO_PHASE_INPUTS].count <= 201);
+  CHECK(st[IONO_PHASE_CYCLE].count == 1000);
+  Iono.inputsSamplingSet(0);
+  IonoSim::frameHook = frameHook;
+
+  // commands are executed outside of the phases: in the cycle only
+  Iono.statsReset();
+  CHECK(Iono.cmdWrite(D10, HIGH) >= 0);
+  run(1);
+  CHECK(Iono.stats(st));
+  CHECK(st[IONO_PHASE_CYCLE].count == 1);
+  CHECK(Iono._prof[IONO_PHASE_CYCLE].sumUs == phasesSumUs() + OUT_FRAME_US);
+
+  IonoSim::frameHook = NULL;
+  TEST_END();
+}
@@ -0,0 +1,121 @@
+/*
+  test_protect.cpp - Outputs over-voltage and thermal shutdown locks,
+  latched faults clear, MAX14912 model status frames
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <SPI.h>
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define REG_IN 0
+#define REG_PP 1
+#define REG_OL 4
+#define REG_THSD 5
+#define REG_OV 7
+#define CMD_READ_REG 0x20
+#define CMD_READ_RT_STAT 0x30
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+// Sends a frame to the D1 ... D8 MAX14912 and returns the answer to the
+// previous one, A byte and Q byte
+static uint16_t frame(uint8_t b1, uint8_t b0) {
+  uint8_t a, q;
+  digitalWrite(IONO_PIN_CS_DOL, LOW);
+  a = SPI.transfer(b1);
+  q = SPI.transfer(b0);
+  SPI.transfer(IonoSim::max14912Crc(b1, b0));
+  digitalWrite(IONO_PIN_CS_DOL, HIGH);
+  return (a << 8) | q;
+}
+
+int main() {
+  IonoSim::Max14912* m = &IonoSim::max14912[0];
+
+  CHECK(Iono.setup());
+  CHECK(Iono.pinMode(D2, OUTPUT_PP));
+  CHECK(Iono.pinMode(D3, OUTPUT_HS));
+  CHECK(Iono.pinMode(D4, OUTPUT_HS));
+  CHECK(Iono.write(D2, HIGH));
+  CHECK(Iono.write(D4, HIGH));
+  run(200);
+
+  // model: faults latched at each frame, cleared by the Z bit unless
+  // still active, real-time status frame
+  m->rt[REG_OL] = 0x08;
+  m->rt[REG_THSD] = 0x02;
+  frame(CMD_READ_RT_STAT, 0);
+  CHECK(frame(CMD_READ_REG, REG_OL) == ((0x0a << 8) | 0x0a));
+  CHECK(frame(CMD_READ_REG, REG_THSD) == ((0x08 << 8) | 0x08));
+  m->rt[REG_OL] = 0;
+  CHECK(frame(CMD_READ_REG, REG_OL) == ((0x02 << 8) | 0x02));
+  CHECK(frame(0x80 | CMD_READ_REG, REG_OL) == 0x08);
+  CHECK(frame(CMD_READ_REG, REG_THSD) == 0);
+  CHECK(frame(CMD_READ_RT_STAT, 0) == ((0x02 << 8) | 0x02));
+  CHECK(IonoSim::outputRead(D2) == LOW);
+  m->rt[REG_THSD] = 0;
+  frame(CMD_READ_RT_STAT, 0);
+  CHECK(IonoSim::outputRead(D2) == HIGH);
+  run(200);
+
+  // thermal shutdown: D2 locked off and out of push-pull until 30s
+  // after the fault is gone, the latched state is cleared on request
+  m->rt[REG_THSD] = 0x02;
+  run(100);
+  CHECK(Iono.thermalShutdownLockRead(D2) == HIGH);
+  CHECK(Iono.thermalShutdownRead(D2) == HIGH);
+  CHECK((m->reg[REG_IN] & 0x02) == 0);
+  CHECK((m->reg[REG_PP] & 0x02) == 0);
+  CHECK(!Iono.write(D2, HIGH));
+  run(100);
+  CHECK((m->reg[REG_IN] & 0x02) == 0);
+  m->rt[REG_THSD] = 0;
+  run(100);
+  CHECK((m->reg[REG_THSD] & 0x02) != 0);
+  CHECK(Iono.outputsClearFaults(D2));
+  run(100);
+  CHECK(m->reg[REG_THSD] == 0);
+  run(29000);
+  CHECK(Iono.thermalShutdownLockRead(D2) == HIGH);
+  run(1000);
+  CHECK(Iono.thermalShutdownLockRead(D2) == LOW);
+  CHECK((m->reg[REG_IN] & 0x02) != 0);
+  CHECK((m->reg[REG_PP] & 0x02) != 0);
+  CHECK(IonoSim::outputRead(D2) == HIGH);
+
+  // over-voltage on a high-side output: switched on and locked until
+  // 10s after the fault is gone, then back to the state set
+  m->rt[REG_OV] = 0x04;
+  run(200);
+  CHECK(Iono.overVoltageLockRead(D3) == HIGH);
+  CHECK(Iono.overVoltageRead(D3) == HIGH);
+  CHECK((m->reg[REG_IN] & 0x04) != 0);
+  CHECK(IonoSim::outputRead(D3) == HIGH);
+  m->rt[REG_OV] = 0;
+  run(9000);
+  CHECK(Iono.overVoltageLockRead(D3) == HIGH);
+  run(1500);
+  CHECK(Iono.overVoltageLockRead(D3) == LOW);
+  CHECK((m->reg[REG_IN] & 0x04) == 0);
+  CHECK(IonoSim::outputRead(D3) == LOW);
+  CHECK(IonoSim::outputRead(D4) == HIGH);
+
+  TEST_END();
+}
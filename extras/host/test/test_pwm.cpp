@@ -0,0 +1,175 @@
+/*
+  test_pwm.cpp - Soft-PWM edges, batching, stagger and measured timing
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include <vector>
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define CHANNELS 4
+
+// Rising and falling edge times of D1 ... D4, as seen after each
+// process() call
+static std::vector<unsigned long> _rise[CHANNELS];
+static std::vector<unsigned long> _fall[CHANNELS];
+static bool _level[CHANNELS];
+
+// MAX14912 frames changing the outputs and bits changed by each
+static uint8_t _regIn;
+static std::vector<int> _setStateBits;
+
+static void frameHook(int cs) {
+  if (cs != IONO_PIN_CS_DOL) {
+    return;
+  }
+  uint8_t regIn = IonoSim::max14912[0].reg[0];
+  if (regIn != _regIn) {
+    _setStateBits.push_back(__builtin_popcount(regIn ^ _regIn));
+    _regIn = regIn;
+  }
+}
+
+static void reset() {
+  for (int i = 0; i < CHANNELS; i++) {
+    _rise[i].clear();
+    _fall[i].clear();
+  }
+  _setStateBits.clear();
+}
+
+static void sample() {
+  for (int i = 0; i < CHANNELS; i++) {
+    bool level = IonoSim::outputRead(D1 + i);
+    if (level != _level[i]) {
+      (level ? _rise[i] : _fall[i]).push_back(micros());
+      _level[i] = level;
+    }
+  }
+}
+
+// loop1() of the examples: process() at the next edge, at least every
+// millisecond
+static void runNext(unsigned long us) {
+  unsigned long end = micros() + us;
+  while ((long) (end - micros()) > 0) {
+    Iono.process();
+    sample();
+    unsigned long next = Iono.pwmNextUs();
+    IonoSim::advanceUs(next < 1000 ? (next > 0 ? next : 1) : 1000);
+  }
+}
+
+// process() every millisecond
+static void runFixed(unsigned long us) {
+  unsigned long end = micros() + us;
+  while ((long) (end - micros()) > 0) {
+    Iono.process();
+    sample();
+    IonoSim::advanceUs(1000);
+  }
+}
+
+int main() {
+  unsigned long periodUs;
+  long dutyErrUs;
+
+  CHECK(Iono.setup());
+  for (int i = 0; i < CHANNELS; i++) {
+    CHECK(Iono.pinMode(D1 + i, OUTPUT_PP));
+  }
+  runFixed(10000);
+  _regIn = IonoSim::max14912[0].reg[0];
+  IonoSim::frameHook = frameHook;
+
+  // invalid frequencies, the running PWM is kept
+  CHECK(!Iono.pwmSet(D5, 100, 1000));
+  CHECK(Iono.pwmSet(D1, 100, 65535 / 4));
+  CHECK(!Iono.pwmSet(D1, 0, 1000));
+  CHECK(!Iono.pwmSet(D1, 1000001, 1000));
+  CHECK(Iono.pwmStats(D1, &periodUs, &dutyErrUs));
+  CHECK(Iono.pwmSet(D1, 0, 0));
+  CHECK(!Iono.pwmStats(D1, &periodUs, &dutyErrUs));
+  runFixed(2000);
+
+  // driven by pwmNextUs(): exact period and duty cycle, the edges of
+  // the channels are applied together with one frame
+  for (int i = 0; i < CHANNELS; i++) {
+    CHECK(Iono.pwmSet(D1 + i, 100, 65535 / 4));
+  }
+  reset();
+  unsigned long t0 = micros();
+  runNext(100000);
+  for (int i = 0; i < CHANNELS; i++) {
+    CHECK(_rise[i].size() >= 10 && _fall[i].size() >= 10);
+    for (size_t k = 0; k < _rise[i].size() && k < _fall[i].size(); k++) {
+      CHECK(_rise[i][k] == t0 + k * 10000);
+      CHECK(_fall[i][k] == t0 + k * 10000 + 2499);
+    }
+    CHECK(Iono.pwmStats(D1 + i, &periodUs, &dutyErrUs));
+    CHECK(periodUs == 10000 && dutyErrUs == 0);
+  }
+  CHECK(!_setStateBits.empty());
+  for (int bits : _setStateBits) {
+    CHECK(bits == CHANNELS);
+  }
+
+  // staggered: rising edges spread over the period by pin
+  Iono.pwmStagger(true);
+  for (int i = 0; i < CHANNELS; i++) {
+    CHECK(Iono.pwmSet(D1 + i, 100, 65535 / 4));
+  }
+  reset();
+  runNext(100000);
+  for (int i = 1; i < CHANNELS; i++) {
+    CHECK(_rise[i].size() >= 9 && _rise[0].size() >= 9);
+    for (size_t k = 0; k < _rise[i].size() && k < _rise[0].size(); k++) {
+      CHECK(_rise[i][k] - _rise[0][k] == 625ul * i);
+    }
+  }
+  for (int bits : _setStateBits) {
+    CHECK(bits == 1);
+  }
+  Iono.pwmStagger(false);
+  for (int i = 0; i < CHANNELS; i++) {
+    CHECK(Iono.pwmSet(D1 + i, 0, 0));
+  }
+  runFixed(2000);
+
+  // process() every millisecond, period not a multiple of it: each
+  // edge is up to a cycle late, the phase is kept, the measured period
+  // is the actual one
+  reset();
+  CHECK(Iono.pwmSet(D1, 300, 65535 / 2));
+  t0 = micros();
+  runFixed(1000000);
+  CHECK(_rise[0].size() >= 299);
+  unsigned long minUs = 0xffffffff;
+  unsigned long maxUs = 0;
+  for (size_t k = 0; k < _rise[0].size(); k++) {
+    unsigned long due = t0 + k * 3333;
+    CHECK(_rise[0][k] >= due && _rise[0][k] < due + 1000);
+    if (k > 0) {
+      unsigned long p = _rise[0][k] - _rise[0][k - 1];
+      minUs = p < minUs ? p : minUs;
+      maxUs = p > maxUs ? p : maxUs;
+    }
+  }
+  CHECK(minUs == 3000 && maxUs == 4000);
+  CHECK(Iono.pwmStats(D1, &periodUs, &dutyErrUs));
+  CHECK(periodUs == 3000 || periodUs == 4000);
+  CHECK(dutyErrUs > -1000 && dutyErrUs < 1000);
+
+  TEST_END();
+}
@@ -0,0 +1,164 @@
+/*
+  test_read_regs.cpp - MAX14912 chained registers read: answers matched
+  to their registers across CRC errors, repeat limit, faults clear
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoSim.h"
+#include "test.h"
+
+#define private public
+#include "IonoD16.h"
+#undef private
+
+#define SPI_ATTEMPTS 3
+#define REG_OL 4
+
+static IonoSim::Max14912* _sim = &IonoSim::max14912[0];
+
+// Frames of the read in progress, answers to flag as corrupted: bit j
+// = answer carried by frame j, the first frame is 0
+static int _frame;
+static uint32_t _corrupt;
+
+// Fault latched again after the first frame
+static bool _relatch;
+
+static void frameHook(int cs) {
+  if (cs == IONO_PIN_CS_DOL) {
+    _frame++;
+    if ((_corrupt >> _frame) & 1) {
+      _sim->respCrcErr = true;
+    }
+    if (_relatch && _frame == 1) {
+      _sim->reg[REG_OL] = 0x08;
+    }
+  }
+}
+
+static const byte _regs[] = {5, 0, 7, 2, 6, 1};
+#define REGS_NUM 6
+
+static byte _a[8], _q[8];
+
+// Reads _regs with the given answers corrupted, returns the frames sent
+static int readRegs(uint32_t corrupt, bool* ok) {
+  uint32_t frames = _sim->frames;
+  memset(_a, 0, sizeof(_a));
+  memset(_q, 0, sizeof(_q));
+  _frame = 0;
+  _corrupt = corrupt;
+  *ok = Iono._max14912ReadRegs(&Iono._max14912[0], _regs, REGS_NUM, _a, _q);
+  _corrupt = 0;
+  return _sim->frames - frames;
+}
+
+static bool dataOk(const byte* regs, int n) {
+  for (int k = 0; k < n; k++) {
+    if (_a[k] != _sim->rt[regs[k]] || _q[k] != _sim->reg[regs[k]]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  bool ok;
+
+  CHECK(Iono.setup());
+  // a distinct answer from each register, fault registers already
+  // latched with their real-time status
+  for (int r = 0; r < 8; r++) {
+    _sim->rt[r] = 0x40 + r;
+    _sim->reg[r] = 0x10 + r;
+    if (r >= REG_OL) {
+      _sim->reg[r] |= _sim->rt[r];
+    }
+  }
+  IonoSim::frameHook = frameHook;
+
+  // n registers in n + 1 frames
+  CHECK(readRegs(0, &ok) == REGS_NUM + 1);
+  CHECK(ok);
+  CHECK(dataOk(_regs, REGS_NUM));
+  CHECK(!Iono._max14912[0].error);
+
+  // any answer corrupted: requested again, two more frames
+  for (int j = 1; j <= REGS_NUM; j++) {
+    CHECK(readRegs(1 << j, &ok) == REGS_NUM + 3);
+    CHECK(ok);
+    CHECK(dataOk(_regs, REGS_NUM));
+  }
+
+  // the answer carried by the repeated request is discarded anyway
+  CHECK(readRegs(0x06, &ok) == REGS_NUM + 3);
+  CHECK(ok);
+  CHECK(dataOk(_regs, REGS_NUM));
+
+  // two registers
+  CHECK(readRegs(0x12, &ok) == REGS_NUM + 5);
+  CHECK(ok);
+  CHECK(dataOk(_regs, REGS_NUM));
+
+  // the same register failing up to the attempts limit, the repeated
+  // request answering in the second frame after the failed one
+  CHECK(readRegs(0x14, &ok) == REGS_NUM + 5);
+  CHECK(ok);
+  CHECK(dataOk(_regs, REGS_NUM));
+  CHECK(readRegs(0x54, &ok) == 7);
+  CHECK(!ok);
+  CHECK(Iono._max14912[0].error);
+  CHECK(readRegs(0, &ok) == REGS_NUM + 1);
+  CHECK(ok);
+  CHECK(!Iono._max14912[0].error);
+
+  // faults clear requested with the first register, kept pending while
+  // its answer fails, sent again with the repeated request
+  static const byte ol[] = {REG_OL, 0};
+  _sim->rt[REG_OL] = 0;
+  Iono._max14912[0].clearFaults = true;
+  _frame = 0;
+  _corrupt = 0x2a;
+  CHECK(!Iono._max14912ReadRegs(&Iono._max14912[0], ol, 1, _a, _q));
+  CHECK(Iono._max14912[0].clearFaults);
+  _frame = 0;
+  _corrupt = 0x02;
+  _relatch = true;
+  CHECK(Iono._max14912ReadRegs(&Iono._max14912[0], ol, 2, _a, _q));
+  _corrupt = 0;
+  _relatch = false;
+  CHECK(!Iono._max14912[0].clearFaults);
+  CHECK(_sim->reg[REG_OL] == 0);
+  CHECK(dataOk(ol, 2));
+
+  // random bit errors on MISO: the reads fail or return the right data
+  _sim->rt[REG_OL] = 0x44;
+  _sim->reg[REG_OL] = 0x54;
+  int okNum = 0;
+  IonoSim::spiBitErrors(0, 20);
+  for (int i = 0; i < 2000; i++) {
+    readRegs(0, &ok);
+    if (ok) {
+      CHECK(dataOk(_regs, REGS_NUM));
+      okNum++;
+    }
+  }
+  IonoSim::spiBitErrors(0, 0);
+  CHECK(okNum > 1800 && okNum < 2000);
+  IonoD16SpiStats st;
+  CHECK(Iono.spiStats(IONO_SPI_DOL, &st));
+  CHECK(st.crcErrors > 2000);
+
+  IonoSim::frameHook = NULL;
+  TEST_END();
+}
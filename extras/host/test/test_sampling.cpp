@@ -0,0 +1,102 @@
+/*
+  test_sampling.cpp - Inputs sampling: LATCH strobe, other reads
+  between two samples, jitter
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+static void run(int cycles, unsigned long us = 1000) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.process();
+    IonoSim::advanceUs(us);
+  }
+}
+
+static void setInputs(bool high) {
+  for (int p = D1; p <= D16; p++) {
+    IonoSim::inputWrite(p, high);
+  }
+}
+
+// Raises all the inputs right after the first MAX22190 frame
+static bool _hookArmed;
+
+static void raiseAfterFirstRead(int cs) {
+  if (_hookArmed && (cs == IONO_PIN_CS_DIL || cs == IONO_PIN_CS_DIH)) {
+    _hookArmed = false;
+    setInputs(true);
+  }
+}
+
+static uint16_t snapshotInputs(unsigned long* ts) {
+  IonoD16Snapshot s;
+  Iono.snapshotRead(&s);
+  *ts = s.inputsTs;
+  return s.inputs;
+}
+
+int main() {
+  unsigned long ts, ts2;
+
+  CHECK(Iono.setup());
+  // transparent while high, as driven at setup
+  CHECK(IonoSim::pinModes[IONO_PIN_MAX22190_LATCH] == OUTPUT);
+  CHECK(IonoSim::pins[IONO_PIN_MAX22190_LATCH] == HIGH);
+  run(10);
+  CHECK(Iono.ready());
+
+  // read on every cycle: the two chips are read at different instants
+  IonoSim::frameHook = raiseAfterFirstRead;
+  _hookArmed = true;
+  run(1);
+  uint16_t in = snapshotInputs(&ts);
+  CHECK(in != 0 && in != 0xffff);
+  run(1);
+  CHECK(snapshotInputs(&ts) == 0xffff);
+  setInputs(false);
+  run(1);
+
+  // sampled: all 16 inputs captured on the LATCH edge
+  Iono.inputsSamplingSet(10000);
+  run(1);
+  CHECK(IonoSim::pins[IONO_PIN_MAX22190_LATCH] == HIGH);
+  _hookArmed = true;
+  run(10);
+  CHECK(snapshotInputs(&ts) == 0);
+  CHECK(!_hookArmed);
+
+  // the FAULT poll between two samples leaves inputs and timestamp alone
+  CHECK(Iono.diagPollSet(IONO_DIAG_FAULT, 1, 255));
+  uint32_t frames = IonoSim::max22190[0].frames;
+  run(5);
+  CHECK(IonoSim::max22190[0].frames > frames);
+  CHECK(snapshotInputs(&ts2) == 0);
+  CHECK(ts2 == ts);
+  CHECK(Iono.read(D1) == LOW);
+  run(5);
+  CHECK(snapshotInputs(&ts2) == 0xffff);
+  CHECK(ts2 - ts == 10000);
+
+  // jitter: late by up to one process() period
+  Iono.inputsSamplingJitterUs();
+  run(100, 700);
+  unsigned long jitter = Iono.inputsSamplingJitterUs();
+  CHECK(jitter > 0 && jitter < 700);
+  CHECK(Iono.inputsSamplingJitterUs() == 0);
+
+  IonoSim::frameHook = NULL;
+  TEST_END();
+}
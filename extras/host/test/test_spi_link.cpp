@@ -0,0 +1,94 @@
+/*
+  test_spi_link.cpp - Adaptive SPI clock under injected bit errors
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+static const int chips[] = {IONO_SPI_DIL, IONO_SPI_DIH, IONO_SPI_DOL, IONO_SPI_DOH};
+
+static uint32_t minClockHz;
+
+static void run(int cycles) {
+  for (int i = 0; i < cycles; i++) {
+    Iono.write(D1, i % 2);
+    Iono.write(D16, i % 2);
+    Iono.process();
+    if (IonoSim::spiClockHz < minClockHz) {
+      minClockHz = IonoSim::spiClockHz;
+    }
+    IonoSim::advanceUs(1000);
+  }
+}
+
+static IonoD16SpiStats stats(int chip) {
+  IonoD16SpiStats s;
+  Iono.spiStats(chip, &s);
+  return s;
+}
+
+int main() {
+  IonoD16SpiStats s;
+  uint32_t crcErrors[4];
+
+  CHECK(Iono.setup());
+  CHECK(Iono.pinMode(D1, OUTPUT_HS));
+  CHECK(Iono.pinMode(D16, OUTPUT_HS));
+  run(10);
+  CHECK(Iono.ready());
+
+  // clean bus: no errors, full speed
+  minClockHz = UINT32_MAX;
+  run(2000);
+  for (int c : chips) {
+    s = stats(c);
+    CHECK(s.frames > 0);
+    CHECK(s.crcErrors == 0);
+    CHECK(s.retries == 0);
+    CHECK(s.errors == 0);
+    CHECK(s.clockHz == IONO_SPI_CLOCK_MAX_HZ);
+  }
+  CHECK(minClockHz == IONO_SPI_CLOCK_MAX_HZ);
+
+  // errors above 3 MHz: each chip backs off until the errors stop
+  IonoSim::spiBitErrors(3000000, 50);
+  run(5000);
+  for (int i = 0; i < 4; i++) {
+    s = stats(chips[i]);
+    CHECK(s.crcErrors > 0);
+    CHECK(s.clockHz <= 3000000);
+    CHECK(s.clockHz >= IONO_SPI_CLOCK_HZ);
+    crcErrors[i] = s.crcErrors;
+  }
+  CHECK(minClockHz >= IONO_SPI_CLOCK_HZ);
+  run(2000);
+  for (int i = 0; i < 4; i++) {
+    s = stats(chips[i]);
+    CHECK(s.crcErrors == crcErrors[i]);
+    CHECK(s.clockHz <= 3000000);
+  }
+
+  // errors at any clock: never below IONO_SPI_CLOCK_HZ
+  IonoSim::spiBitErrors(0, 50);
+  run(5000);
+  for (int c : chips) {
+    s = stats(c);
+    CHECK(s.clockHz == IONO_SPI_CLOCK_HZ);
+  }
+  CHECK(minClockHz >= IONO_SPI_CLOCK_HZ);
+  CHECK(IonoSim::spiClockHz >= IONO_SPI_CLOCK_HZ);
+
+  TEST_END();
+}
@@ -0,0 +1,183 @@
+/*
+  test_wiegand.cpp - Wiegand frames through the PIO model
+
+    Copyright (C) 2022 Sfera Labs S.r.l. - All rights reserved.
+
+    For information, see:
+    https://www.sferalabs.cc/
+
+  This code is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  See file LICENSE.txt for further informations on licensing terms.
+*/
+
+#include "IonoD16.h"
+#include "IonoSim.h"
+#include "test.h"
+
+#define ITVL_MIN_US 700
+#define ITVL_MAX_US 2700
+#define WIDTH_MIN_US 20
+#define WIDTH_MAX_US 150
+
+static unsigned long _processTs;
+static bool _processHold;
+
+// Runs the PIOs, with process() called every millisecond unless held
+static void run(unsigned long us) {
+  for (unsigned long i = 0; i < us; i++) {
+    IonoSim::runUs(1);
+    if (!_processHold && IonoSim::nowUs() - _processTs >= 1000) {
+      _processTs = IonoSim::nowUs();
+      Iono.process();
+    }
+  }
+}
+
+// Reader pulse model: D0 (bit 0) and D1 (bit 1) are pulled up and
+// pulled low for widthUs, one pulse every itvlUs, first bit MSB
+static void pulse(int pinD0, int bit, unsigned long widthUs, unsigned long itvlUs) {
+  int pin = pinD0 + (bit ? 1 : 0);
+  IonoSim::pins[pin] = LOW;
+  run(widthUs);
+  IonoSim::pins[pin] = HIGH;
+  run(itvlUs - widthUs);
+}
+
+static void frame(int pinD0, uint64_t data, int bits) {
+  for (int i = bits - 1; i >= 0; i--) {
+    pulse(pinD0, (data >> i) & 1, 50, 1000);
+  }
+  run(ITVL_MAX_US + 10000);
+}
+
+// Standard format: even parity over the first half, odd parity over
+// the second one
+static uint64_t encode(int bits, int cardBits, uint32_t facility, uint32_t card, bool badParity) {
+  int half = (bits + 1) / 2;
+  uint64_t d = (((uint64_t) facility << cardBits) | card) << 1;
+  if (__builtin_popcountll(d >> (bits - half)) & 1) {
+    d |= 1ull << (bits - 1);
+  }
+  if ((__builtin_popcountll(d & ((1ull << half) - 1)) & 1) == 0) {
+    d |= 1;
+  }
+  if (badParity) {
+    d ^= 1ull << 3;
+  }
+  return d;
+}
+
+int main() {
+  IonoD16WiegandFrame f[IONO_WGND_QUEUE_LEN + 1];
+  uint64_t data;
+  unsigned long ts;
+
+  for (int p = DT1; p <= DT4; p++) {
+    IonoSim::pins[p] = HIGH;
+  }
+  CHECK(Iono.setup());
+  CHECK(Iono.wiegandAvailable(DT1) == -1);
+  CHECK(!Iono.wiegandSetup(DT2, ITVL_MIN_US, ITVL_MAX_US, WIDTH_MIN_US, WIDTH_MAX_US));
+  CHECK(Iono.wiegandSetup(DT1, ITVL_MIN_US, ITVL_MAX_US, WIDTH_MIN_US, WIDTH_MAX_US));
+  CHECK(Iono.wiegandSetup(DT3, ITVL_MIN_US, ITVL_MAX_US, WIDTH_MIN_US, WIDTH_MAX_US));
+  CHECK(!Iono.wiegandSetup(DT1, ITVL_MIN_US, ITVL_MAX_US, WIDTH_MIN_US, WIDTH_MAX_US));
+  run(5000);
+
+  // standard formats
+  frame(DT1, encode(26, 16, 123, 45678, false), 26);
+  frame(DT1, encode(34, 16, 4321, 65000, false), 34);
+  frame(DT1, encode(37, 19, 777, 400000, false), 37);
+  CHECK(Iono.wiegandAvailable(DT1) == 3);
+  CHECK(Iono.wiegandReadFrames(DT1, f, IONO_WGND_QUEUE_LEN) == 3);
+  CHECK(f[0].bits == 26 && f[0].status == IONO_WGND_VALID);
+  CHECK(f[0].facility == 123 && f[0].card == 45678);
+  CHECK(f[1].bits == 34 && f[1].status == IONO_WGND_VALID);
+  CHECK(f[1].facility == 4321 && f[1].card == 65000);
+  CHECK(f[2].bits == 37 && f[2].status == IONO_WGND_VALID);
+  CHECK(f[2].facility == 777 && f[2].card == 400000);
+  CHECK(f[2].data == encode(37, 19, 777, 400000, false));
+  CHECK(f[1].ts - f[0].ts > 34000);
+  CHECK(Iono.wiegandNoise(DT1) == 0);
+
+  // parity errors and raw lengths
+  frame(DT1, encode(26, 16, 1, 2, true), 26);
+  frame(DT1, encode(34, 16, 1, 2, true), 34);
+  frame(DT1, 0x1234, 16);
+  CHECK(Iono.wiegandReadFrames(DT1, f, IONO_WGND_QUEUE_LEN) == 3);
+  CHECK(f[0].bits == 26 && f[0].status == IONO_WGND_PARITY_ERR);
+  CHECK(f[1].bits == 34 && f[1].status == IONO_WGND_PARITY_ERR);
+  CHECK(f[2].bits == 16 && f[2].status == IONO_WGND_RAW && f[2].data == 0x1234);
+
+  // the other reader
+  frame(DT3, encode(26, 16, 200, 1000, false), 26);
+  CHECK(Iono.wiegandAvailable(DT1) == 0);
+  CHECK(Iono.wiegandRead(DT3, &data, &ts) == 26);
+  CHECK(data == encode(26, 16, 200, 1000, false));
+  CHECK(Iono.wiegandRead(DT3, &data, &ts) == 0);
+
+  // noise: short pulse, then a pulse too close to the previous one,
+  // the frame following each error is received
+  pulse(DT1, 1, 50, 1000);
+  pulse(DT1, 0, 5, 1000);
+  run(ITVL_MAX_US + 10000);
+  CHECK(Iono.wiegandNoise(DT1) == IONO_WGND_NOISE_WIDTH);
+  CHECK(Iono.wiegandNoise(DT1) == 0);
+  pulse(DT1, 1, 50, 1000);
+  pulse(DT1, 1, 50, 300);
+  pulse(DT1, 0, 50, 1000);
+  run(ITVL_MAX_US + 10000);
+  CHECK(Iono.wiegandNoise(DT1) == IONO_WGND_NOISE_ITVL);
+  CHECK(Iono.wiegandRead(DT1, &data, NULL) == 0);
+  frame(DT1, encode(26, 16, 5, 6, false), 26);
+  CHECK(Iono.wiegandRead(DT1, &data, NULL) == 26);
+  CHECK(data == encode(26, 16, 5, 6, false));
+
+  // more than 64 bits: the first 65 are dropped, the rest is a frame
+  frame(DT1, 0, 64);
+  CHECK(Iono.wiegandRead(DT1, &data, NULL) == 64);
+  for (int i = 0; i < 70; i++) {
+    pulse(DT1, i & 1, 50, 1000);
+  }
+  run(ITVL_MAX_US + 10000);
+  CHECK(Iono.wiegandNoise(DT1) == IONO_WGND_NOISE_OVERFLOW);
+  CHECK(Iono.wiegandRead(DT1, &data, NULL) == 5);
+
+  // queue overflow, the oldest frames are kept
+  for (int i = 0; i <= IONO_WGND_QUEUE_LEN; i++) {
+    frame(DT1, encode(26, 16, 1, i, false), 26);
+  }
+  CHECK(Iono.wiegandAvailable(DT1) == IONO_WGND_QUEUE_LEN);
+  CHECK(Iono.wiegandNoise(DT1) == IONO_WGND_NOISE_QUEUE);
+  CHECK(Iono.wiegandReadFrames(DT1, f, IONO_WGND_QUEUE_LEN + 1) == IONO_WGND_QUEUE_LEN);
+  for (int i = 0; i < IONO_WGND_QUEUE_LEN; i++) {
+    CHECK(f[i].card == (uint32_t) i);
+  }
+  CHECK(Iono.wiegandAvailable(DT1) == 0);
+
+  // RX FIFO overrun, process() held for longer than the pulses the FIFO
+  // can hold, during a whole frame or part of it: the frame is discarded
+  // and the following one received
+  for (int held = 12; held <= 26; held += 14) {
+    uint64_t d = encode(26, 16, 9, held, false);
+    _processHold = true;
+    for (int i = 25; i >= 0; i--) {
+      if (25 - i == held) {
+        _processHold = false;
+      }
+      pulse(DT1, (d >> i) & 1, 50, 1000);
+    }
+    _processHold = false;
+    run(ITVL_MAX_US + 10000);
+    CHECK(Iono.wiegandNoise(DT1) == IONO_WGND_NOISE_FIFO);
+    CHECK(Iono.wiegandAvailable(DT1) == 0);
+    frame(DT1, encode(26, 16, 9, 10, false), 26);
+    CHECK(Iono.wiegandReadFrames(DT1, f, IONO_WGND_QUEUE_LEN) == 1);
+    CHECK(f[0].status == IONO_WGND_VALID && f[0].card == 10);
+    CHECK(Iono.wiegandNoise(DT1) == 0);
+  }
+
+  TEST_END();
+}
@@ -16,6 +16,8 @@
 #include "IonoD16.h"
 #include <Arduino.h>
 #include <Wire.h>
+#include <hardware/gpio.h>
+#include <hardware/clocks.h>
 
 #define MAX22190_REG_WB 0x00
 #define MAX22190_REG_FAULT1 0x04
@@ -44,9 +46,166 @@
 #define _MAX14912_CMD_READ_REG 0b100000
 #define _MAX14912_CMD_READ_RT_STAT 0b110000
 
+#define _CMD_PIN_MODE 0
+#define _CMD_WRITE 1
+#define _CMD_WRITE_MASK 2
+#define _CMD_OUTPUTS_JOIN 3
+#define _CMD_PWM_SET 4
+
+#define _MAX22190_FAULT1_ACTIVE 0x3f
+
+#define _DIAG_FAST_DIV 4
+#define _DIAG_FAST_MS 2000
+#define _DIAG_OUT_REGS ((1 << IONO_DIAG_OL) | (1 << IONO_DIAG_OV) | \
+          (1 << IONO_DIAG_STATE) | (1 << IONO_DIAG_THSD))
+#define _DIAG_OUT_REGS_MAX 4
+
 #define _PROT_OV_LOCK_MS 10000
 #define _PROT_THSD_LOCK_MS 30000
 
+#define _SPI_ATTEMPTS 3
+
+#define _MAX22190_CRC_INIT 0x07 // 5-bit init word, 00111
+#define _MAX22190_CRC_POLY 0x35 // 6-bit polynomial, 110101
+#define _MAX14912_CRC_INIT 0x7f
+#define _MAX14912_CRC_POLY 0xB7 // 0x37 with MSBit on purpose
+
+// CRC lookup tables, generated at compile time =====
+
+// Remainder of the division of the nBits value v by the MAX22190
+// CRC polynomial
+static constexpr byte _max22190CrcMod(uint32_t v, int nBits) {
+  for (int i = nBits - 1; i >= 5; i--) {
+    if ((v >> i) & 1) {
+      v ^= (uint32_t) _MAX22190_CRC_POLY << (i - 5);
+    }
+  }
+  return (byte) v;
+}
+
+static constexpr byte _max14912CrcLoop(byte crc, byte byte1) {
+  for (int i = 0; i < 8; i++) {
+    crc <<= 1;
+    if (crc & 0x80)
+      crc ^= _MAX14912_CRC_POLY;
+    if (byte1 & 0x80)
+      crc ^=1;
+    byte1 <<= 1;
+  }
+  return crc;
+}
+
+static constexpr struct max22190CrcTablesStr {
+  byte data[256]; // byte mod poly
+  byte rem[32];   // (remainder * x^8) mod poly
+  byte read[32];  // CRC of the read frame of each register
+  constexpr max22190CrcTablesStr() : data(), rem(), read() {
+    for (int i = 0; i < 256; i++) {
+      data[i] = _max22190CrcMod(i, 8);
+    }
+    for (int i = 0; i < 32; i++) {
+      rem[i] = _max22190CrcMod(i << 8, 13);
+    }
+    for (int i = 0; i < 32; i++) {
+      read[i] = _max22190CrcMod(((uint32_t) i << 16) | _MAX22190_CRC_INIT, 24);
+    }
+  }
+} _max22190CrcTables;
+
+// The MAX14912 CRC loop is linear, so the syndrome update
+// loop(synd, byte) is split as synd[synd] ^ data[byte]
+static constexpr struct max14912CrcTablesStr {
+  byte synd[256];
+  byte data[256];
+  constexpr max14912CrcTablesStr() : synd(), data() {
+    for (int i = 0; i < 256; i++) {
+      synd[i] = _max14912CrcLoop(i, 0);
+      data[i] = _max14912CrcLoop(0, i);
+    }
+  }
+} _max14912CrcTables;
+
+static constexpr byte _MAX14912_READ_STAT_CRC = _max14912CrcLoop(_max14912CrcLoop(
+    _max14912CrcLoop(_MAX14912_CRC_INIT, _MAX14912_CMD_READ_RT_STAT), 0), 0x80) & 0x7f;
+
+// PIO counter program =============
+// Counts the rising edges of the pin in X and the time spent high in Y
+// (one decrement every 2 clock cycles), both counting down from 0:
+//   0 low:  jmp pin rise
+//   1       jmp low
+//   2 rise: jmp x-- high
+//   3 high: jmp y-- next
+//   4 next: jmp pin high
+//   5       jmp low
+static const uint16_t _counterPioInstr[] = {
+  0x00c2, 0x0000, 0x0043, 0x0084, 0x00c3, 0x0000
+};
+
+static const pio_program_t _counterPioProgram = {
+  .instructions = _counterPioInstr,
+  .length = 6,
+  .origin = -1,
+};
+
+// PIO Wiegand program ============
+// Waits for a low pulse on D0 (in pin 0) or D1 (in pin 1) and pushes
+// one word per bit: bit 0 = bit value, bits 1-20 = Y counted down
+// from 0xfffff over the time between the previous pulse end and this
+// pulse start, bits 21-31 = Y counted down from 2047 over the pulse
+// width, stopping at 0. Both loops take 6 clock cycles per count:
+//    0 start: mov y, ~null
+//    1 ilp:   mov osr, pins
+//    2        out x, 1
+//    3        jmp !x fall
+//    4        out x, 1
+//    5        jmp !x one
+//    6        jmp y-- ilp
+//    7        jmp ilp
+//    8 one:   set x, 1
+//    9 fall:  in x, 1
+//   10        in y, 20
+//   11        mov osr, ~null
+//   12        out null, 21
+//   13        mov y, osr
+//   14 wlp:   mov osr, ~pins
+//   15        out x, 2
+//   16        jmp !x rel
+//   17        jmp y-- wlp [2]
+//   18        mov y, null
+//   19 slp:   mov osr, ~pins
+//   20        out x, 2
+//   21        jmp !x rel
+//   22        jmp slp
+//   23 rel:   in y, 11
+//   24        push noblock
+static const uint16_t _wgndPioInstr[] = {
+  0xa04b, 0xa0e0, 0x6021, 0x0029, 0x6021, 0x0028, 0x0081, 0x0001,
+  0xe021, 0x4021, 0x4054, 0xa0eb, 0x6075, 0xa047, 0xa0e8, 0x6022,
+  0x0037, 0x028e, 0xa043, 0xa0e8, 0x6022, 0x0037, 0x0013, 0x404b,
+  0x8000
+};
+
+static const pio_program_t _wgndPioProgram = {
+  .instructions = _wgndPioInstr,
+  .length = 25,
+  .origin = -1,
+};
+
+#define _PROF_NONE 0xffffffff
+
+// Phases timing, with the timestamps kept in process() locals
+#if IONO_PROFILE
+#define _PROF_START() profTs = micros()
+#define _PROF_END(phase) profUs[phase] = micros() - profTs
+#else
+#define _PROF_START()
+#define _PROF_END(phase)
+#endif
+
+#define _WGND_PIO_CYCLES_PER_US 6
+#define _WGND_ITVL_MASK 0xfffff
+#define _WGND_WIDTH_MAX 2047
+
 IonoD16Class::IonoD16Class() {
 }
 
@@ -54,13 +213,20 @@ bool IonoD16Class::_getBit(byte source, int bitIdx) {
   return ((source >> bitIdx) & 1) == 1;
 }
 
+byte IonoD16Class::_bitRev(byte b) {
+  b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+  b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
 void IonoD16Class::_setBit(byte* target, int bitIdx, bool val) {
   byte mask = 1 << bitIdx;
   *target = (*target & ~mask) | (val ? mask : 0);
 }
 
-void IonoD16Class::_spiTransaction(
-      int cs, byte d2, byte d1, byte d0, byte* r2, byte* r1, byte* r0) {
+void IonoD16Class::_spiTransaction(int cs, const SPISettings& settings,
+      byte d2, byte d1, byte d0, byte* r2, byte* r1, byte* r0) {
 #ifdef IONO_DEBUG
   Serial.print(">>> ");
   Serial.println(cs);
@@ -71,14 +237,16 @@ void IonoD16Class::_spiTransaction(
 
   ::digitalWrite(cs, LOW);
 
-  SPI.beginTransaction(_spiSettings);
-  *r2 = SPI.transfer(d2);
-  *r1 = SPI.transfer(d1);
-  *r0 = SPI.transfer(d0);
-  SPI.endTransaction();
+  IONO_SPI.beginTransaction(settings);
+  *r2 = IONO_SPI.transfer(d2);
+  *r1 = IONO_SPI.transfer(d1);
+  *r0 = IONO_SPI.transfer(d0);
+  IONO_SPI.endTransaction();
 
   ::digitalWrite(cs, HIGH);
 
+  _spiFrames++;
+
 #ifdef IONO_DEBUG
   Serial.print("<<< ");
   Serial.println(cs);
@@ -88,43 +256,86 @@ void IonoD16Class::_spiTransaction(
 #endif
 }
 
-// MAX22190 =======================
-
-byte IonoD16Class::_max22190Crc(byte data2, byte data1, byte data0) {
-  int length = 19; // 19-bit data
-  byte crc_init = 0x07; // 5-bit init word, constant, 00111
-  byte crc_poly = 0x35; // 6-bit polynomial, constant, 110101
-  byte crc_step;
-  byte tmp;
+void IonoD16Class::_spiLinkInit(struct spiLinkStr* l) {
+  l->clockHz = IONO_SPI_ADAPTIVE ? IONO_SPI_CLOCK_MAX_HZ : IONO_SPI_CLOCK_HZ;
+  l->settings = SPISettings(l->clockHz, MSBFIRST, SPI_MODE0);
+  l->frames = 0;
+  l->crcErrors = 0;
+  l->retries = 0;
+  l->errors = 0;
+  l->winFrames = 0;
+  l->winCrcErrors = 0;
+}
 
-  uint32_t datainput = (unsigned long)((data2 << 16) + (data1 << 8) + data0);
-  datainput = (datainput & 0xffffe0) + crc_init;
-  tmp = (byte)((datainput & 0xfc0000) >> 18);
-  if ((tmp & 0x20) == 0x20)
-    crc_step = (byte)(tmp ^ crc_poly);
-  else
-    crc_step = tmp;
+// Must be called holding _spiMtx, once per transaction attempt
+void IonoD16Class::_spiLinkUpdate(struct spiLinkStr* l, int frames, int attempt, bool crcErr) {
+  l->frames += frames;
+  l->winFrames += frames;
+  if (attempt > 0) {
+    l->retries++;
+  }
+  if (crcErr) {
+    l->crcErrors++;
+    l->winCrcErrors++;
+    if (attempt == _SPI_ATTEMPTS - 1) {
+      l->errors++;
+    }
+  }
+#if IONO_SPI_ADAPTIVE
+  if (l->winCrcErrors >= IONO_SPI_CRC_ERR_MAX) {
+    if (l->clockHz > IONO_SPI_CLOCK_HZ) {
+      l->clockHz /= 2;
+      if (l->clockHz < IONO_SPI_CLOCK_HZ) {
+        l->clockHz = IONO_SPI_CLOCK_HZ;
+      }
+      l->settings = SPISettings(l->clockHz, MSBFIRST, SPI_MODE0);
+    }
+    l->winFrames = 0;
+    l->winCrcErrors = 0;
+  }
+#endif
+  if (l->winFrames >= IONO_SPI_CRC_WINDOW) {
+    l->winFrames = 0;
+    l->winCrcErrors = 0;
+  }
+}
 
-  for (int i = 0; i < length - 1; i++) {
-    tmp = (byte)(((crc_step & 0x1f) << 1) + ((datainput >> (length - 2 - i)) & 0x01));
-    if ((tmp & 0x20) == 0x20)
-      crc_step = (byte)(tmp ^ crc_poly);
-    else
-      crc_step = tmp;
+struct IonoD16Class::spiLinkStr* IonoD16Class::_spiLinkGet(int chip) {
+  switch (chip) {
+    case IONO_SPI_DIL:
+      return &_max22190[_MAX22190_IDX_L].link;
+    case IONO_SPI_DIH:
+      return &_max22190[_MAX22190_IDX_H].link;
+    case IONO_SPI_DOL:
+      return &_max14912[_MAX14912_IDX_L].link;
+    case IONO_SPI_DOH:
+      return &_max14912[_MAX14912_IDX_H].link;
   }
+  return NULL;
+}
+
+// MAX22190 =======================
 
-  return (byte)(crc_step & 0x1f);
+byte IonoD16Class::_max22190Crc(byte data2, byte data1, byte data0) {
+  // 19-bit data followed by the 5-bit init word, processed one byte at a time
+  byte crc = _max22190CrcTables.data[data2];
+  crc = _max22190CrcTables.rem[crc] ^ _max22190CrcTables.data[data1];
+  crc = _max22190CrcTables.rem[crc] ^
+          _max22190CrcTables.data[(data0 & 0xe0) | _MAX22190_CRC_INIT];
+  return crc;
 }
 
-bool IonoD16Class::_max22190SpiTransaction(struct max22190Str* m, byte* data1, byte* data0) {
+bool IonoD16Class::_max22190SpiTransaction(struct max22190Str* m, byte* data1, byte* data0, byte crc) {
   byte r1, r0, rcrc;
-  byte crc = _max22190Crc(*data1, *data0, 0);
   bool ok = false;
-  for (int i = 0; i < 3; i++) {
+  bool crcErr;
+  for (int i = 0; i < _SPI_ATTEMPTS; i++) {
     mutex_enter_blocking(&_spiMtx);
-    _spiTransaction(m->pinCs, *data1, *data0, crc, &r1, &r0, &rcrc);
+    _spiTransaction(m->pinCs, m->link.settings, *data1, *data0, crc, &r1, &r0, &rcrc);
+    crcErr = (rcrc & 0x1f) != _max22190Crc(r1, r0, rcrc);
+    _spiLinkUpdate(&m->link, 1, i, crcErr);
     mutex_exit(&_spiMtx);
-    if ((rcrc & 0x1f) == _max22190Crc(r1, r0, rcrc)) {
+    if (!crcErr) {
       *data1 = r1;
       *data0 = r0;
       ok = true;
@@ -137,12 +348,16 @@ bool IonoD16Class::_max22190SpiTransaction(struct max22190Str* m, byte* data1, b
   return ok;
 }
 
-bool IonoD16Class::_max22190ReadReg(byte regAddr, struct max22190Str* m, byte* data) {
+// The inputs state carried by every answer is only returned to the
+// sampling read: other reads happen at different instants, unlatched
+bool IonoD16Class::_max22190ReadReg(byte regAddr, struct max22190Str* m, byte* data, byte* inputs) {
   byte data1 = regAddr;
   byte data0 = 0;
-  if (_max22190SpiTransaction(m, &data1, &data0)) {
+  if (_max22190SpiTransaction(m, &data1, &data0, _max22190CrcTables.read[regAddr & 0x1f])) {
     m->error = false;
-    m->inputs = data1;
+    if (inputs != NULL) {
+      *inputs = data1;
+    }
     *data = data0;
     return true;
   }
@@ -152,7 +367,7 @@ bool IonoD16Class::_max22190ReadReg(byte regAddr, struct max22190Str* m, byte* d
 
 bool IonoD16Class::_max22190WriteReg(byte regAddr, struct max22190Str* m, byte data0) {
   byte data1 = 0x80 | regAddr;
-  return _max22190SpiTransaction(m, &data1, &data0);
+  return _max22190SpiTransaction(m, &data1, &data0, _max22190Crc(data1, data0, 0));
 }
 
 bool IonoD16Class::_max22190GetByPin(int pin, struct max22190Str** m, int* inIdx) {
@@ -174,56 +389,34 @@ bool IonoD16Class::_max22190GetByPin(int pin, struct max22190Str** m, int* inIdx
 
 // MAX14912 =======================
 
-byte IonoD16Class::_max14912CrcLoop(byte crc, byte byte1) {
-  for (int i = 0; i < 8; i++) {
-    crc <<= 1;
-    if (crc & 0x80)
-      crc ^= 0xB7; // 0x37 with MSBit on purpose
-    if (byte1 & 0x80)
-      crc ^=1;
-    byte1 <<= 1;
-  }
-  return crc;
-}
-
 byte IonoD16Class::_max14912Crc(byte byte1, byte byte2) {
   byte synd;
-  synd = _max14912CrcLoop(0x7f, byte1);
-  synd = _max14912CrcLoop(synd, byte2);
-  return _max14912CrcLoop(synd, 0x80) & 0x7f;
+  synd = _max14912CrcTables.synd[_MAX14912_CRC_INIT] ^ _max14912CrcTables.data[byte1];
+  synd = _max14912CrcTables.synd[synd] ^ _max14912CrcTables.data[byte2];
+  return (_max14912CrcTables.synd[synd] ^ _max14912CrcTables.data[0x80]) & 0x7f;
 }
 
-bool IonoD16Class::_max14912SpiTransaction(bool wr, struct max14912Str* m, byte* data1, byte* data0) {
+bool IonoD16Class::_max14912SpiTransaction(struct max14912Str* m, byte* data1, byte* data0) {
   byte r1, r0, rcrc;
   byte zBit = m->clearFaults ? 0x80 : 0x00;
   byte crc = _max14912Crc(zBit | *data1, *data0);
   bool ok = false;
-  for (int i = 0; i < 3; i++) {
+  bool crcErr;
+  for (int i = 0; i < _SPI_ATTEMPTS; i++) {
 #ifdef IONO_DEBUG
     if (i != 0) {
       Serial.println("repeat");
     }
 #endif
     mutex_enter_blocking(&_spiMtx);
-    _spiTransaction(m->pinCs, zBit | *data1, *data0, crc, &r1, &r0, &rcrc);
-#ifdef IONO_DEBUG
-    if ((rcrc & 0x80) == 0x80) {
-      Serial.println("CRC err 1");
-    }
-#endif
-    if (wr) {
-      _spiTransaction(m->pinCs, _MAX14912_CMD_READ_RT_STAT, 0, _max14912ReadStatCrc, &r1, &r0, &rcrc);
-      mutex_exit(&_spiMtx);
-      if ((rcrc & 0x80) == 0x80) {
-#ifdef IONO_DEBUG
-        Serial.println("CRC err 2");
-#endif
-        continue;
-      }
-    } else {
-      mutex_exit(&_spiMtx);
+    _spiTransaction(m->pinCs, m->link.settings, zBit | *data1, *data0, crc, &r1, &r0, &rcrc);
+    crcErr = (rcrc & 0x7f) != _max14912Crc(r1, r0);
+    _spiLinkUpdate(&m->link, 1, i, crcErr);
+    if (!crcErr) {
+      m->frameTs = millis();
     }
-    if ((rcrc & 0x7f) == _max14912Crc(r1, r0)) {
+    mutex_exit(&_spiMtx);
+    if (!crcErr) {
       *data1 = r1;
       *data0 = r0;
       ok = true;
@@ -236,27 +429,88 @@ bool IonoD16Class::_max14912SpiTransaction(bool wr, struct max14912Str* m, byte*
   return ok;
 }
 
-bool IonoD16Class::_max14912ReadReg(byte regAddr, struct max14912Str* m, byte* dataA, byte* dataQ) {
-  byte data1 = _MAX14912_CMD_READ_REG;
-  byte data0 = regAddr;
-  if (_max14912SpiTransaction(true, m, &data1, &data0)) {
-    m->error = false;
-    if (dataA) {
-      *dataA = data1;
-    }
-    if (dataQ) {
-      *dataQ = data0;
+// Sends READ_REG for regAddr, or READ_RT_STAT if regAddr < 0, and
+// returns the answer to the previous frame
+void IonoD16Class::_max14912ReadFrame(struct max14912Str* m, int regAddr, bool z,
+      byte* r1, byte* r0, byte* rcrc) {
+  byte cmd;
+  if (regAddr < 0) {
+    _spiTransaction(m->pinCs, m->link.settings,
+        _MAX14912_CMD_READ_RT_STAT, 0, _MAX14912_READ_STAT_CRC, r1, r0, rcrc);
+  } else {
+    cmd = (z ? 0x80 : 0x00) | _MAX14912_CMD_READ_REG;
+    _spiTransaction(m->pinCs, m->link.settings,
+        cmd, regAddr, _max14912Crc(cmd, regAddr), r1, r0, rcrc);
+  }
+}
+
+// Reads n registers chaining the commands: each frame requests the next
+// register and carries the answer to the previous one, so n registers
+// take n + 1 frames. An answer failing the CRC check, or reporting a
+// corrupted request, is requested again up to _SPI_ATTEMPTS times
+bool IonoD16Class::_max14912ReadRegs(struct max14912Str* m, const byte* regAddrs, int n,
+      byte* dataA, byte* dataQ) {
+  byte r1, r0, rcrc;
+  bool z = m->clearFaults;
+  bool crcErr;
+  bool ok = true;
+  int attempt = 0;
+  int k = 0;
+
+  mutex_enter_blocking(&_spiMtx);
+  _max14912ReadFrame(m, regAddrs[0], z, &r1, &r0, &rcrc);
+  _spiLinkUpdate(&m->link, 1, 0, false);
+  while (k < n) {
+    _max14912ReadFrame(m, k + 1 < n ? regAddrs[k + 1] : -1, false, &r1, &r0, &rcrc);
+    crcErr = (rcrc & 0x80) == 0x80 || (rcrc & 0x7f) != _max14912Crc(r1, r0);
+    _spiLinkUpdate(&m->link, 1, attempt, crcErr);
+    if (!crcErr) {
+      dataA[k] = r1;
+      dataQ[k] = r0;
+      if (k == 0 && z) {
+        m->clearFaults = false;
+      }
+      k++;
+      attempt = 0;
+    } else if (++attempt == _SPI_ATTEMPTS) {
+      ok = false;
+      break;
+    } else {
+#ifdef IONO_DEBUG
+      Serial.println("repeat");
+#endif
+      // the frame just sent requested the following register
+      _max14912ReadFrame(m, regAddrs[k], z && k == 0, &r1, &r0, &rcrc);
+      _spiLinkUpdate(&m->link, 1, 0, false);
     }
-    return true;
   }
-  m->error = true;
-  return false;
+  if (ok) {
+    m->frameTs = millis();
+  }
+  mutex_exit(&_spiMtx);
+
+  m->error = !ok;
+  return ok;
+}
+
+bool IonoD16Class::_max14912ReadReg(byte regAddr, struct max14912Str* m, byte* dataA, byte* dataQ) {
+  byte a, q;
+  if (!_max14912ReadRegs(m, &regAddr, 1, &a, &q)) {
+    return false;
+  }
+  if (dataA) {
+    *dataA = a;
+  }
+  if (dataQ) {
+    *dataQ = q;
+  }
+  return true;
 }
 
 bool IonoD16Class::_max14912Cmd(byte cmd, struct max14912Str* m, byte data) {
   byte data1 = cmd;
   byte data0 = data;
-  return _max14912SpiTransaction(false, m, &data1, &data0);
+  return _max14912SpiTransaction(m, &data1, &data0);
 }
 
 bool IonoD16Class::_max14912Config(struct max14912Str* m, byte cmd, byte checkRegAddr, byte val) {
@@ -385,7 +639,30 @@ bool IonoD16Class::_writeOutputProtected(int pin, int val) {
   return _max14912OutputSet(m, outIdx, val);
 }
 
-bool IonoD16Class::_outputsJoinable(int pin) {
+bool IonoD16Class::_writeOutputsProtected(struct max14912Str* m, byte mask, byte vals) {
+  byte locked = mask & (m->ovLock | m->thsdLock);
+  m->outputsUser = (m->outputsUser & ~mask) | (vals & mask);
+  mask &= ~locked;
+  if (mask != 0) {
+    m->outputs = (m->outputs & ~mask) | (vals & mask);
+    if (!_max14912Cmd(_MAX14912_CMD_SET_STATE, m, m->outputs)) {
+      return false;
+    }
+  }
+  return locked == 0;
+}
+
+uint16_t IonoD16Class::_outputsModeMask() {
+  uint16_t mask = 0;
+  for (int i = 0; i < 16; i++) {
+    if (_pinMode[i] == OUTPUT_HS || _pinMode[i] == OUTPUT_PP) {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+bool IonoD16Class::_outputsJoinable(int pin, const int* modes) {
   int idx = pin - 1;
   int base4 = (idx / 4) * 4;
   int mod4 = idx % 4;
@@ -404,21 +681,289 @@ bool IonoD16Class::_outputsJoinable(int pin) {
     idxHs1 = base4 + 2;
     idxHs2 = base4 + 3;
   }
-  if (_pinMode[idxHs1] != OUTPUT_HS) {
+  if (modes[idxHs1] != OUTPUT_HS) {
     return false;
   }
-  if (_pinMode[idxHs2] != OUTPUT_HS) {
+  if (modes[idxHs2] != OUTPUT_HS) {
     return false;
   }
-  if (_pinMode[idxHsOrIn1] != OUTPUT_HS && _pinMode[idxHsOrIn1] != INPUT) {
+  if (modes[idxHsOrIn1] != OUTPUT_HS && modes[idxHsOrIn1] != INPUT) {
     return false;
   }
-  if (_pinMode[idxHsOrIn2] != OUTPUT_HS && _pinMode[idxHsOrIn2] != INPUT) {
+  if (modes[idxHsOrIn2] != OUTPUT_HS && modes[idxHsOrIn2] != INPUT) {
     return false;
   }
   return true;
 }
 
+bool IonoD16Class::_configureInputs(int idx, const IonoD16PinConfig* cfg) {
+  struct max22190Str* m = &_max22190[idx];
+  int pin, inIdx;
+  byte val;
+  bool ok = true;
+
+  for (pin = D1 + idx * 8; pin < D1 + (idx + 1) * 8; pin++) {
+    if (!_max22190GetByPin(pin, &m, &inIdx)) {
+      return false;
+    }
+    m->cfgFlt[inIdx] = (m->cfgFlt[inIdx] & 0x0f) |
+          ((cfg[pin - D1].mode == INPUT && cfg[pin - D1].wbol) ? 0x10 : 0x00);
+  }
+  for (inIdx = 0; inIdx < 8; inIdx++) {
+    ok &= _max22190WriteReg(MAX22190_REG_FLT1 + (inIdx * 2), m, m->cfgFlt[inIdx]);
+  }
+  for (inIdx = 0; ok && inIdx < 8; inIdx++) {
+    ok = _max22190ReadReg(MAX22190_REG_FLT1 + (inIdx * 2), m, &val, NULL) &&
+          val == m->cfgFlt[inIdx];
+  }
+  return ok;
+}
+
+bool IonoD16Class::_configureOutputs(int idx, const IonoD16PinConfig* cfg, byte* locked) {
+  static const byte regs[] = {
+    MAX14912_REG_IN, MAX14912_REG_OL_EN, MAX14912_REG_PP, MAX14912_REG_WD_JN
+  };
+  struct max14912Str* m = &_max14912[idx];
+  const IonoD16PinConfig* c;
+  byte inputs = 0, olDet = 0, modePP = 0, join = 0;
+  byte a[4], q[4];
+  int outIdx;
+
+  for (outIdx = 0; outIdx < 8; outIdx++) {
+    c = &cfg[idx * 8 + outIdx];
+    if (c->mode == INPUT) {
+      _setBit(&inputs, outIdx, true);
+      continue;
+    }
+    _setBit(&olDet, outIdx, c->wbol);
+    _setBit(&modePP, outIdx, c->mode == OUTPUT_PP);
+    if (c->join) {
+      _setBit(&join, (outIdx <= 3) ? 2 : 3, true);
+    }
+  }
+
+  *locked = m->ovLock | m->thsdLock;
+  m->outputsUser &= ~inputs;
+  m->outputs &= ~(inputs & ~*locked);
+  m->cfgOlDet = olDet;
+  m->cfgModePPUser = modePP;
+  m->cfgModePP = (modePP & ~*locked) | (m->cfgModePP & *locked);
+  m->cfgJoin = join;
+  if (inputs != 0xff) {
+    m->ovProtEn = true;
+  }
+
+  // outputs of the new inputs are switched off before changing mode
+  if (!_max14912Cmd(_MAX14912_CMD_SET_STATE, m, m->outputs) ||
+        !_max14912Cmd(_MAX14912_CMD_SET_OL_DET, m, m->cfgOlDet) ||
+        !_max14912Cmd(_MAX14912_CMD_SET_MODE, m, m->cfgModePP) ||
+        !_max14912Cmd(_MAX14912_CMD_SET_CONFIG, m, m->cfgJoin)) {
+    return false;
+  }
+  if (!_max14912ReadRegs(m, regs, 4, a, q)) {
+    return false;
+  }
+  return q[0] == m->outputs && q[1] == m->cfgOlDet &&
+          q[2] == m->cfgModePP && q[3] == m->cfgJoin;
+}
+
+bool IonoD16Class::_diagUsable(int task) {
+  for (int i = 0; i < _MAX14912_NUM; i++) {
+    if (task == IONO_DIAG_OL && _max14912[i].cfgOlDet != 0) {
+      return true;
+    }
+    if (task == IONO_DIAG_OV &&
+          (_max14912[i].cfgModePP != 0xff || _max14912[i].ovLock != 0)) {
+      return true;
+    }
+  }
+  return task != IONO_DIAG_OL && task != IONO_DIAG_OV;
+}
+
+// Real-time faults of all the peripherals, one bit per fault and pin
+uint32_t IonoD16Class::_diagFaultBits() {
+  uint32_t bits = 0;
+  int i;
+  for (i = 0; i < _MAX22190_NUM; i++) {
+    bits |= (uint32_t) (_max22190[i].fault1 & _MAX22190_FAULT1_ACTIVE) << (i * 6);
+  }
+  for (i = 0; i < _MAX14912_NUM; i++) {
+    bits |= (uint32_t) (_max14912[i].olRT | _max14912[i].ovRT | _max14912[i].thsdRT) << (12 + i * 8);
+  }
+  return bits;
+}
+
+void IonoD16Class::_diagProcess() {
+  struct diagStr* d;
+  unsigned long ts = millis();
+  unsigned long periodMs, late;
+  unsigned long bestLate = 0;
+  int best = -1;
+  uint32_t due = 0;
+  uint32_t tasks;
+  uint32_t faults = _diagFaultBits();
+
+  // A new fault is followed polling faster for a while, a permanent
+  // one does not keep the bus busy
+  if ((faults & ~_diagFaults) != 0) {
+    _diagFast = true;
+    _diagFastTs = ts;
+  } else if (_diagFast && ts - _diagFastTs >= _DIAG_FAST_MS) {
+    _diagFast = false;
+  }
+  _diagFaults = faults;
+  bool fast = _diagFast;
+
+  // At most one register group is polled per cycle: the due one with
+  // the highest priority, the most overdue among equal priorities
+  for (int k = 0; k < _DIAG_NUM; k++) {
+    d = &_diag[k];
+    if (d->periodMs == 0 || !_diagUsable(k)) {
+      continue;
+    }
+    periodMs = fast ? d->periodMs / _DIAG_FAST_DIV : d->periodMs;
+    late = ts - d->lastTs;
+    if (late < periodMs) {
+      continue;
+    }
+    late -= periodMs;
+    due |= 1 << k;
+    if (best < 0 || d->priority > _diag[best].priority ||
+          (d->priority == _diag[best].priority && late > bestLate)) {
+      best = k;
+      bestLate = late;
+    }
+  }
+
+  if (_outputsRefreshMs != 0 && (ts - _diag[IONO_DIAG_STATE].lastTs) >= _outputsRefreshMs) {
+    // the outputs refresh interval overrides the polling priorities
+    best = IONO_DIAG_STATE;
+  }
+
+  if (best >= 0) {
+    tasks = 1 << best;
+    if ((tasks & _DIAG_OUT_REGS) != 0) {
+      // the outputs registers due are read in a single pipelined sweep
+      tasks |= due & _DIAG_OUT_REGS;
+    }
+    _diagRun(tasks);
+    for (int k = 0; k < _DIAG_NUM; k++) {
+      if ((tasks & (1 << k)) != 0) {
+        _diag[k].lastTs = ts;
+      }
+    }
+  }
+
+  if (_outputsKeepaliveMs != 0) {
+    // while the watchdog is armed, a peripheral not addressed by any
+    // other frame is kept alive re-asserting the expected state
+    for (int i = 0; i < _MAX14912_NUM; i++) {
+      if ((long) (millis() - _max14912[i].frameTs) >= (long) _outputsKeepaliveMs) {
+        _max14912Cmd(_MAX14912_CMD_SET_STATE, &_max14912[i], _max14912[i].outputs);
+      }
+    }
+  }
+}
+
+void IonoD16Class::_diagRun(uint32_t tasks) {
+  int i;
+  struct max22190Str* mi;
+
+  if ((tasks & (1 << IONO_DIAG_FAULT)) != 0) {
+    for (i = 0; i < _MAX22190_NUM; i++) {
+      mi = &_max22190[i];
+      _max22190ReadReg(MAX22190_REG_FAULT1, mi, &mi->fault1, NULL);
+      _faultLatch(IONO_FAULT_ALRM_T1, _getBit(mi->fault1, 3) ? 0xff << (i * 8) : 0);
+      _faultLatch(IONO_FAULT_ALRM_T2, _getBit(mi->fault1, 4) ? 0xff << (i * 8) : 0);
+    }
+    for (i = 0; i < _MAX22190_NUM; i++) {
+      mi = &_max22190[i];
+      if (_getBit(mi->fault1, 5)) {
+        _max22190ReadReg(MAX22190_REG_FAULT2, mi, &mi->fault2, NULL);
+        _faultLatch(IONO_FAULT_THSD, _getBit(mi->fault2, 4) ? 0xff << (i * 8) : 0);
+      }
+    }
+  }
+
+  if ((tasks & _DIAG_OUT_REGS) != 0) {
+    for (i = 0; i < _MAX14912_NUM; i++) {
+      _diagOutputsRead(i, tasks);
+    }
+  }
+}
+
+void IonoD16Class::_diagOutputsRead(int idx, uint32_t tasks) {
+  struct max14912Str* mo = &_max14912[idx];
+  byte regs[_DIAG_OUT_REGS_MAX];
+  byte a[_DIAG_OUT_REGS_MAX];
+  byte q[_DIAG_OUT_REGS_MAX];
+  int ol = -1, ov = -1, in = -1, thsd = -1;
+  int n = 0;
+  byte outputs = mo->outputs;
+
+  // unread registers keep their previous values
+  if ((tasks & (1 << IONO_DIAG_OL)) != 0) {
+    if (mo->cfgOlDet == 0) {
+      mo->olRT = 0;
+    } else {
+      ol = n++;
+      regs[ol] = MAX14912_REG_OL;
+      a[ol] = mo->olRT;
+      q[ol] = mo->ol;
+    }
+  }
+  if ((tasks & (1 << IONO_DIAG_OV)) != 0) {
+    if (mo->cfgModePP == 0xff && mo->ovLock == 0) {
+      // no high-side channels
+      mo->ovRT = 0;
+    } else {
+      ov = n++;
+      regs[ov] = MAX14912_REG_OV;
+      a[ov] = mo->ovRT;
+    }
+  }
+  if ((tasks & (1 << IONO_DIAG_STATE)) != 0) {
+    in = n++;
+    regs[in] = MAX14912_REG_IN;
+    q[in] = outputs;
+  }
+  if ((tasks & (1 << IONO_DIAG_THSD)) != 0) {
+    thsd = n++;
+    regs[thsd] = MAX14912_REG_THSD;
+    a[thsd] = mo->thsdRT;
+    q[thsd] = mo->thsd;
+  }
+  if (n == 0) {
+    return;
+  }
+
+  _max14912ReadRegs(mo, regs, n, a, q);
+
+  if (ol >= 0) {
+    mo->olRT = a[ol];
+    mo->ol = q[ol];
+    _faultLatch(IONO_FAULT_OL, mo->olRT << (idx * 8));
+  }
+  if (ov >= 0) {
+    mo->ovRT = a[ov];
+    _faultLatch(IONO_FAULT_OV, mo->ovRT << (idx * 8));
+    if (mo->ovProtEn) {
+      _max14912OverVoltProt(mo);
+    }
+  }
+  if (in >= 0 && q[in] != outputs && mo->outputs == outputs) {
+    // outputs not changed by the other core while verifying
+    mo->outputsMismatch++;
+    _max14912Cmd(_MAX14912_CMD_SET_STATE, mo, mo->outputs);
+  }
+  if (thsd >= 0) {
+    mo->thsdRT = a[thsd];
+    mo->thsd = q[thsd];
+    _faultLatch(IONO_FAULT_THSD, mo->thsdRT << (idx * 8));
+    _max14912ThermalProt(mo);
+  }
+}
+
 void IonoD16Class::_subscribeProcess(struct subscribeStr* s) {
   int val = read(s->pin);
   unsigned long ts = millis();
@@ -433,40 +978,180 @@ void IonoD16Class::_subscribeProcess(struct subscribeStr* s) {
   }
 }
 
-void IonoD16Class::_linkProcess(struct linkStr* l) {
-  if (l->inPin == 0 || l->outPin == 0 || l->mode == LINK_NONE) {
-    return;
+uint16_t IonoD16Class::_inputsGet() {
+  // bit 0 = D1 ... bit 15 = D16
+  return _bitRev(_max22190[_MAX22190_IDX_L].inputs) |
+          (_bitRev(_max22190[_MAX22190_IDX_H].inputs) << 8);
+}
+
+bool IonoD16Class::_linkProcess(struct linkStr* l, uint16_t inputs, unsigned long ts) {
+  if (l->inPin < D1 || l->inPin > D16) {
+    return false;
+  }
+  int val = ((inputs >> (l->inPin - D1)) & 1) == 1 ? HIGH : LOW;
+  if (l->reset) {
+    // mode or debounce changed by link(), applied to the current state
+    l->reset = false;
+    l->value = -1;
+    l->pending = true;
+    l->lastTs = ts;
   }
-  int val = read(l->inPin);
-  unsigned long ts = millis();
   if (l->value != val) {
-    if ((ts - l->lastTs) >= l->debounceMs) {
-      l->value = val;
-      l->lastTs = ts;
-      switch (l->mode) {
-        case LINK_FOLLOW:
-          write(l->outPin, val);
-          break;
-        case LINK_INVERT:
-          write(l->outPin, val == HIGH ? LOW : HIGH);
-          break;
-        case LINK_FLIP_T:
+    if (!l->pending) {
+      // the input was stable at the previous evaluation
+      l->pending = true;
+      l->lastTs = _linkTs;
+    }
+    if ((ts - l->lastTs) < l->debounceMs) {
+      return true;
+    }
+    l->value = val;
+    l->lastTs = ts;
+    l->pending = false;
+    switch (l->mode) {
+      case LINK_FOLLOW:
+        write(l->outPin, val);
+        break;
+      case LINK_INVERT:
+        write(l->outPin, val == HIGH ? LOW : HIGH);
+        break;
+      case LINK_FLIP_T:
+        flip(l->outPin);
+        break;
+      case LINK_FLIP_H:
+        if (val == HIGH) {
           flip(l->outPin);
-          break;
-        case LINK_FLIP_H:
-          if (val == HIGH) {
-            flip(l->outPin);
-          }
-          break;
-        case LINK_FLIP_L:
-          if (val == LOW) {
-            flip(l->outPin);
-          }
-          break;
-      }
+        }
+        break;
+      case LINK_FLIP_L:
+        if (val == LOW) {
+          flip(l->outPin);
+        }
+        break;
     }
   } else {
     l->lastTs = ts;
+    l->pending = false;
+  }
+  return false;
+}
+
+void IonoD16Class::_inputsSample() {
+  struct max22190Str* mi;
+  unsigned long ts, jitter;
+  bool latch = _sampleItvlUs != 0;
+
+  if (latch) {
+    // both peripherals capture their inputs at the same instant
+    ::digitalWrite(IONO_PIN_MAX22190_LATCH, LOW);
+  }
+  ts = micros();
+  for (int i = 0; i < _MAX22190_NUM; i++) {
+    mi = &_max22190[i];
+    _max22190ReadReg(MAX22190_REG_WB, mi, &mi->wb, &mi->inputs);
+    _faultLatch(IONO_FAULT_WB, _bitRev(mi->wb) << (i * 8));
+  }
+  if (latch) {
+    ::digitalWrite(IONO_PIN_MAX22190_LATCH, HIGH);
+    jitter = ts - _sampleNextTs;
+    if (jitter > _sampleJitterUs) {
+      _sampleJitterUs = jitter;
+    }
+    _sampleNextTs += _sampleItvlUs;
+    if ((long) (ts - _sampleNextTs) >= 0) {
+      // more than a period late, restart the schedule
+      _sampleNextTs = ts + _sampleItvlUs;
+    }
+  }
+  _inputsTs = ts;
+}
+
+void IonoD16Class::_eventsProcess() {
+  // bits 0-15: D1 ... D16, bits 16-19: DT1 ... DT4
+  uint32_t inputs = _inputsGet();
+  unsigned long tsDT = micros();
+  uint32_t changed;
+  uint32_t head = _evHead;
+  IonoD16Event* e;
+  int i;
+  for (i = 0; i < 4; i++) {
+    if (::digitalRead(DT1 + i) == HIGH) {
+      inputs |= 1ul << (16 + i);
+    }
+  }
+  // a change is queued once the new state has been stable for the
+  // debounce time, with the timestamp of its first sample. Changes
+  // reverted earlier are dropped
+  changed = inputs ^ _evInputs;
+  for (uint32_t c = changed & ~_evPending; c != 0; c &= c - 1) {
+    i = __builtin_ctz(c);
+    _evPendingTs[i] = i < 16 ? _inputsTs : tsDT;
+  }
+  _evPending = changed;
+  changed = 0;
+  for (uint32_t c = _evPending; c != 0; c &= c - 1) {
+    i = __builtin_ctz(c);
+    if (tsDT - _evPendingTs[i] >= _evDebounceUs) {
+      changed |= 1ul << i;
+    }
+  }
+  _evPending &= ~changed;
+  _evInputs ^= changed;
+  while (changed != 0) {
+    i = __builtin_ctz(changed);
+    changed &= changed - 1;
+    if (head - _evTail >= IONO_EVENT_QUEUE_LEN) {
+      // sequence numbers of lost events are skipped
+      _evSeq++;
+      _evLost = _evLost + 1;
+      continue;
+    }
+    e = &_ev[head % IONO_EVENT_QUEUE_LEN];
+    e->seq = _evSeq++;
+    e->ts = _evPendingTs[i];
+    e->pin = i < 16 ? D1 + i : DT1 + (i - 16);
+    e->value = ((inputs >> i) & 1) == 1 ? HIGH : LOW;
+    head++;
+    __sync_synchronize();
+    _evHead = head;
+  }
+}
+
+void IonoD16Class::_pwmProcess() {
+  struct pwmStr* p;
+  unsigned long ts = micros();
+  unsigned long dts;
+  uint16_t mask = 0;
+  uint16_t vals = 0;
+  for (int i = 0; i < 16; i++) {
+    p = &_pwm[i];
+    if (p->periodUs == 0) {
+      continue;
+    }
+    dts = ts - p->startTs;
+    if (dts >= p->periodUs) {
+      // keep the phase, unless more than a period late
+      p->startTs = (dts >= 2 * p->periodUs) ? ts : p->startTs + p->periodUs;
+      p->on = true;
+      if (p->riseTs != 0) {
+        p->periodMeasUs = ts - p->riseTs;
+      }
+      p->riseTs = ts;
+      mask |= 1 << i;
+      vals |= 1 << i;
+    } else if (p->on && dts >= p->dutyUs) {
+      p->on = false;
+      p->dutyErrUs = (long) (ts - p->riseTs) - (long) p->dutyUs;
+      mask |= 1 << i;
+    }
+  }
+  // edges falling in the same cycle are applied with a single
+  // command per peripheral
+  if ((mask & 0xff) != 0) {
+    _writeOutputsProtected(&_max14912[_MAX14912_IDX_L], mask & 0xff, vals & 0xff);
+  }
+  if ((mask >> 8) != 0) {
+    _writeOutputsProtected(&_max14912[_MAX14912_IDX_H], mask >> 8, vals >> 8);
   }
 }
 
@@ -475,27 +1160,377 @@ void IonoD16Class::_ledCtrl(bool on) {
   mutex_enter_blocking(&_spiMtx);
   ::digitalWrite(IONO_PIN_CS_DOL, on ? LOW : HIGH);
   ::digitalWrite(IONO_PIN_CS_DIH, LOW);
-  _spiTransaction(IONO_PIN_CS_DIL, 0, 0, 0, &x, &x, &x);
+  _spiTransaction(IONO_PIN_CS_DIL, _spiSettings, 0, 0, 0, &x, &x, &x);
   ::digitalWrite(IONO_PIN_CS_DIH, HIGH);
   ::digitalWrite(IONO_PIN_CS_DOL, HIGH);
   mutex_exit(&_spiMtx);
 }
 
-// Public ==========================
-
-bool IonoD16Class::setup() {
-  ::pinMode(IONO_PIN_CS_DOL, OUTPUT);
-  ::pinMode(IONO_PIN_CS_DOH, OUTPUT);
-  ::pinMode(IONO_PIN_CS_DIL, OUTPUT);
-  ::pinMode(IONO_PIN_CS_DIH, OUTPUT);
-
-  ::digitalWrite(IONO_PIN_CS_DOL, HIGH);
-  ::digitalWrite(IONO_PIN_CS_DOH, HIGH);
-  ::digitalWrite(IONO_PIN_CS_DIL, HIGH);
-  ::digitalWrite(IONO_PIN_CS_DIH, HIGH);
+// PIO =============================
+
+bool IonoD16Class::_pioSmClaim(const pio_program_t* prog, PIO* pio, int* sm, int* offset) {
+  // Programs loaded on each PIO, shared by the state machines running
+  // the same one
+  static struct {
+    const pio_program_t* prog;
+    int offset;
+  } loaded[2][4];
+  PIO pios[] = {pio0, pio1};
+  int i, j;
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 4 && loaded[i][j].prog != NULL && loaded[i][j].prog != prog; j++) ;
+    if (j >= 4 || (loaded[i][j].prog == NULL && !pio_can_add_program(pios[i], prog))) {
+      continue;
+    }
+    *sm = pio_claim_unused_sm(pios[i], false);
+    if (*sm < 0) {
+      continue;
+    }
+    if (loaded[i][j].prog == NULL) {
+      loaded[i][j].prog = prog;
+      loaded[i][j].offset = pio_add_program(pios[i], prog);
+    }
+    *pio = pios[i];
+    *offset = loaded[i][j].offset;
+    return true;
+  }
+  return false;
+}
+
+void IonoD16Class::_counterRaw(struct counterStr* c, uint32_t* count, uint32_t* high) {
+  // X and Y are copied to the RX FIFO with forced instructions, the
+  // program keeps running meanwhile. Leftovers of an interrupted read
+  // are dropped first, and the pushes block rather than lose a value
+  while (!pio_sm_is_rx_fifo_empty(c->pio, c->sm)) {
+    pio_sm_get(c->pio, c->sm);
+  }
+  pio_sm_exec(c->pio, c->sm, pio_encode_mov(pio_isr, pio_x));
+  pio_sm_exec(c->pio, c->sm, pio_encode_push(false, true));
+  pio_sm_exec(c->pio, c->sm, pio_encode_mov(pio_isr, pio_y));
+  pio_sm_exec(c->pio, c->sm, pio_encode_push(false, true));
+  *count = -pio_sm_get_blocking(c->pio, c->sm);
+  *high = -pio_sm_get_blocking(c->pio, c->sm);
+}
+
+// Wiegand =========================
+// Bits are timed and queued by the PIO, process() drains the RX FIFO
+// (8 words, i.e. at least 5 ms of pulses) and assembles the frames
+
+bool IonoD16Class::_wiegandGet(int pinD0, struct wgndStr** w) {
+  if (pinD0 == DT1) {
+    *w = &_wgnd[0];
+  } else if (pinD0 == DT3) {
+    *w = &_wgnd[1];
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void IonoD16Class::_wiegandDecode(IonoD16WiegandFrame* f) {
+  // Standard formats: even parity bit first, then facility code and
+  // card number, odd parity bit last. Each parity bit covers half the
+  // frame, the middle bit is shared by both halves in the 37 bits one
+  int fcBits, cardBits, half;
+  uint64_t evenHalf, oddHalf;
+  switch (f->bits) {
+    case 26:
+      fcBits = 8;
+      cardBits = 16;
+      break;
+    case 34:
+      fcBits = 16;
+      cardBits = 16;
+      break;
+    case 37:
+      fcBits = 16;
+      cardBits = 19;
+      break;
+    default:
+      f->status = IONO_WGND_RAW;
+      f->facility = 0;
+      f->card = 0;
+      return;
+  }
+  half = (f->bits + 1) / 2;
+  evenHalf = f->data >> (f->bits - half);
+  oddHalf = f->data & ((1ull << half) - 1);
+  if ((__builtin_popcountll(evenHalf) & 1) != 0 || (__builtin_popcountll(oddHalf) & 1) != 1) {
+    f->status = IONO_WGND_PARITY_ERR;
+  } else {
+    f->status = IONO_WGND_VALID;
+  }
+  f->card = (f->data >> 1) & ((1ul << cardBits) - 1);
+  f->facility = (f->data >> (1 + cardBits)) & ((1ul << fcBits) - 1);
+}
+
+void IonoD16Class::_wiegandFrameEnd(struct wgndStr* w) {
+  uint32_t head = w->head;
+  if (head - w->tail >= IONO_WGND_QUEUE_LEN) {
+    w->noise = IONO_WGND_NOISE_QUEUE;
+  } else {
+    IonoD16WiegandFrame* f = &w->frames[head % IONO_WGND_QUEUE_LEN];
+    f->ts = w->ts;
+    f->bits = w->bits;
+    f->data = w->data;
+    _wiegandDecode(f);
+    __sync_synchronize();
+    w->head = head + 1;
+  }
+  w->bits = 0;
+  w->data = 0;
+}
+
+void IonoD16Class::_wiegandPulse(struct wgndStr* w, uint32_t word, unsigned long ts) {
+  unsigned long itvlUs, widthUs;
+
+  itvlUs = w->lastWidthUs + _WGND_ITVL_MASK - ((word >> 1) & _WGND_ITVL_MASK);
+  widthUs = _WGND_WIDTH_MAX - (word >> 21);
+  w->lastWidthUs = widthUs;
+
+  // Pulses of a frame with some dropped are ignored up to its end
+  if (w->skip) {
+    w->lastTs = ts;
+    if (itvlUs <= w->itvlMaxUs) {
+      return;
+    }
+    w->skip = false;
+  }
+
+  // A pulse coming later than the max interval starts a new frame,
+  // the time measured by the PIO is not relevant for the first bit
+  // of a frame, since it may have wrapped around
+  if (w->bits > 0 && itvlUs > w->itvlMaxUs) {
+    _wiegandFrameEnd(w);
+  }
+  if (widthUs < w->widthMinUs || widthUs > w->widthMaxUs) {
+    w->noise = IONO_WGND_NOISE_WIDTH;
+    w->bits = 0;
+    w->data = 0;
+    return;
+  }
+  if (w->bits > 0 && itvlUs < w->itvlMinUs) {
+    w->noise = IONO_WGND_NOISE_ITVL;
+    w->bits = 0;
+    w->data = 0;
+    return;
+  }
+  if (w->bits >= 64) {
+    w->noise = IONO_WGND_NOISE_OVERFLOW;
+    w->bits = 0;
+    w->data = 0;
+    return;
+  }
+  if (w->bits == 0) {
+    w->ts = ts;
+  }
+  w->data = (w->data << 1) | (word & 1);
+  w->bits++;
+  w->lastTs = ts;
+}
+
+void IonoD16Class::_wiegandProcess(struct wgndStr* w) {
+  uint32_t stall = 1u << (PIO_FDEBUG_RXSTALL_LSB + w->sm);
+  unsigned long ts;
+  int n;
+
+  ts = micros();
+
+  // The PIO drops the pulses coming with the RX FIFO full, i.e. after
+  // the words in it: those are decoded, then the frame in progress is
+  // discarded
+  if (w->pio->fdebug & stall) {
+    w->pio->fdebug = stall;
+    for (n = pio_sm_get_rx_fifo_level(w->pio, w->sm); n > 0; n--) {
+      _wiegandPulse(w, pio_sm_get(w->pio, w->sm), ts);
+    }
+    w->noise = IONO_WGND_NOISE_FIFO;
+    w->bits = 0;
+    w->data = 0;
+    w->skip = true;
+    w->lastTs = ts;
+  }
+  while (!pio_sm_is_rx_fifo_empty(w->pio, w->sm)) {
+    _wiegandPulse(w, pio_sm_get(w->pio, w->sm), ts);
+  }
+
+  // The last bit is drained at most one process() cycle after it was
+  // received, hence the margin on top of the max interval
+  if (ts - w->lastTs > w->itvlMaxUs + 5000) {
+    if (w->bits > 0) {
+      _wiegandFrameEnd(w);
+    }
+    w->skip = false;
+  }
+}
+
+// Commands queue ==================
+// Single-producer single-consumer ring: commands are enqueued by the
+// core not running process() and executed by process(), which owns
+// the SPI bus
+
+int IonoD16Class::_cmdEnqueue(byte type, int a, int b, uint16_t c) {
+  uint32_t head = _cmdHead;
+  if (head - _cmdTail >= IONO_CMD_QUEUE_LEN) {
+    return -1;
+  }
+  struct cmdStr* cmd = &_cmd[head % IONO_CMD_QUEUE_LEN];
+  cmd->type = type;
+  cmd->a = a;
+  cmd->b = b;
+  cmd->c = c;
+  __sync_synchronize();
+  _cmdHead = head + 1;
+  return (int) (head & 0x7fffffff);
+}
+
+void IonoD16Class::_cmdProcess() {
+  uint32_t tail = _cmdTail;
+  uint32_t head = _cmdHead;
+  struct cmdStr* cmd;
+  __sync_synchronize();
+  while (tail != head) {
+    cmd = &_cmd[tail % IONO_CMD_QUEUE_LEN];
+    switch (cmd->type) {
+      case _CMD_PIN_MODE:
+        cmd->ok = pinMode(cmd->a, cmd->b, cmd->c != 0);
+        break;
+      case _CMD_WRITE:
+        cmd->ok = write(cmd->a, cmd->b);
+        break;
+      case _CMD_WRITE_MASK:
+        cmd->ok = writeMask(cmd->a, cmd->c);
+        break;
+      case _CMD_OUTPUTS_JOIN:
+        cmd->ok = outputsJoin(cmd->a, cmd->b != 0);
+        break;
+      case _CMD_PWM_SET:
+        cmd->ok = pwmSet(cmd->a, cmd->b, cmd->c);
+        break;
+      default:
+        cmd->ok = false;
+        break;
+    }
+    if (_cmdCb != NULL) {
+      _cmdCb((int) (tail & 0x7fffffff), cmd->ok);
+    }
+    tail++;
+    __sync_synchronize();
+    _cmdTail = tail;
+  }
+}
+
+// Fault memories and snapshot =====
+// Written by the core running process() under _faultMtx, which the
+// other core takes to clear the latched faults it has read. The
+// snapshot is published under the same lock, so that a reader clears
+// exactly the faults of the image it got.
+
+void IonoD16Class::_faultLatch(int type, uint16_t bits) {
+  if (bits == 0) {
+    return;
+  }
+  mutex_enter_blocking(&_faultMtx);
+  _faultMem[type] |= bits;
+  _faultNew[type] |= bits;
+  mutex_exit(&_faultMtx);
+}
+
+// Called with _faultMtx held. The cleared bits are removed from the
+// published snapshot too, so that they are reported once; bits latched
+// again after it was published are kept
+void IonoD16Class::_faultClear(const uint16_t* masks) {
+  uint16_t faults[_FAULT_NUM];
+  int k;
+  for (k = 0; k < _FAULT_NUM; k++) {
+    _faultMem[k] &= ~(masks[k] & ~_faultNew[k]);
+  }
+  _snapLock = _snapLock + 1;
+  __sync_synchronize();
+  _snapshotFaults(&_snap, faults, false);
+  for (k = 0; k < _FAULT_NUM; k++) {
+    faults[k] &= ~masks[k];
+  }
+  _snapshotFaults(&_snap, faults, true);
+  __sync_synchronize();
+  _snapLock = _snapLock + 1;
+}
+
+int IonoD16Class::_faultReadClear(int type, int pin) {
+  if (pin < D1 || pin > D16) {
+    return -1;
+  }
+  return faultsReadClearType(type, 1 << (pin - D1)) != 0 ? HIGH : LOW;
+}
+
+void IonoD16Class::_snapshotFaults(IonoD16Snapshot* s, uint16_t* faults, bool toSnapshot) {
+  uint16_t* fields[_FAULT_NUM];
+  fields[IONO_FAULT_WB] = &s->wireBreak;
+  fields[IONO_FAULT_OL] = &s->openLoad;
+  fields[IONO_FAULT_OV] = &s->overVoltage;
+  fields[IONO_FAULT_THSD] = &s->thermalShutdown;
+  fields[IONO_FAULT_ALRM_T1] = &s->alarmT1;
+  fields[IONO_FAULT_ALRM_T2] = &s->alarmT2;
+  for (int k = 0; k < _FAULT_NUM; k++) {
+    if (toSnapshot) {
+      *fields[k] = faults[k];
+    } else {
+      faults[k] = *fields[k];
+    }
+  }
+}
+
+void IonoD16Class::_snapshotPublish() {
+  struct max14912Str* mo;
+  int i;
+  mutex_enter_blocking(&_faultMtx);
+  _snapLock = _snapLock + 1;
+  __sync_synchronize();
+  _snap.seq = ++_snapSeq;
+  _snap.ts = micros();
+  _snap.inputs = _inputsGet();
+  _snap.inputsTs = _inputsTs;
+  _snap.outputs = 0;
+  _snap.overVoltageLock = 0;
+  _snap.thermalShutdownLock = 0;
+  _snap.error = 0;
+  for (i = 0; i < _MAX14912_NUM; i++) {
+    mo = &_max14912[i];
+    _snap.outputs |= mo->outputs << (i * 8);
+    _snap.overVoltageLock |= mo->ovLock << (i * 8);
+    _snap.thermalShutdownLock |= mo->thsdLock << (i * 8);
+    _setBit(&_snap.error, _MAX22190_NUM + i, mo->error);
+  }
+  for (i = 0; i < _MAX22190_NUM; i++) {
+    _setBit(&_snap.error, i, _max22190[i].error);
+  }
+  _snapshotFaults(&_snap, _faultMem, true);
+  for (i = 0; i < _FAULT_NUM; i++) {
+    _faultNew[i] = 0;
+  }
+  __sync_synchronize();
+  _snapLock = _snapLock + 1;
+  mutex_exit(&_faultMtx);
+}
+
+// Public ==========================
+
+bool IonoD16Class::setup() {
+  ::pinMode(IONO_PIN_CS_DOL, OUTPUT);
+  ::pinMode(IONO_PIN_CS_DOH, OUTPUT);
+  ::pinMode(IONO_PIN_CS_DIL, OUTPUT);
+  ::pinMode(IONO_PIN_CS_DIH, OUTPUT);
+
+  ::digitalWrite(IONO_PIN_CS_DOL, HIGH);
+  ::digitalWrite(IONO_PIN_CS_DOH, HIGH);
+  ::digitalWrite(IONO_PIN_CS_DIL, HIGH);
+  ::digitalWrite(IONO_PIN_CS_DIH, HIGH);
+
+  ::pinMode(IONO_PIN_MAX22190_LATCH, OUTPUT);
+  ::digitalWrite(IONO_PIN_MAX22190_LATCH, HIGH);
 
   ::pinMode(IONO_PIN_MAX14912_WD_EN, OUTPUT);
-  ::digitalWrite(IONO_PIN_MAX14912_WD_EN, HIGH);
+  outputsWatchdog(IONO_OUTPUTS_KEEPALIVE_MS);
 
   ::pinMode(IONO_PIN_RS485_TXEN_N, OUTPUT);
   rs485TxEn(false);
@@ -505,11 +1540,11 @@ bool IonoD16Class::setup() {
   IONO_RS485.begin(9600);
   IONO_RS485.end();
 
-  SPI.setRX(IONO_PIN_SPI_RX);
-  SPI.setTX(IONO_PIN_SPI_TX);
-  SPI.setSCK(IONO_PIN_SPI_SCK);
-  SPI.begin();
-  _spiSettings = SPISettings(1000000, MSBFIRST, SPI_MODE0);
+  IONO_SPI.setRX(IONO_PIN_SPI_RX);
+  IONO_SPI.setTX(IONO_PIN_SPI_TX);
+  IONO_SPI.setSCK(IONO_PIN_SPI_SCK);
+  IONO_SPI.begin();
+  _spiSettings = SPISettings(IONO_SPI_CLOCK_HZ, MSBFIRST, SPI_MODE0);
 
   Wire.setSDA(IONO_PIN_I2C_SDA);
   Wire.setSCL(IONO_PIN_I2C_SCL);
@@ -519,14 +1554,25 @@ bool IonoD16Class::setup() {
   _max22190[_MAX22190_IDX_H].pinCs = IONO_PIN_CS_DIH;
   _max14912[_MAX14912_IDX_L].pinCs = IONO_PIN_CS_DOL;
   _max14912[_MAX14912_IDX_H].pinCs = IONO_PIN_CS_DOH;
-
-  _max14912ReadStatCrc = _max14912Crc(_MAX14912_CMD_READ_RT_STAT, 0);
+  for (int i = 0; i < _MAX22190_NUM; i++) {
+    _spiLinkInit(&_max22190[i].link);
+  }
+  for (int i = 0; i < _MAX14912_NUM; i++) {
+    _spiLinkInit(&_max14912[i].link);
+  }
 
   mutex_init(&_spiMtx);
+  mutex_init(&_faultMtx);
 
   _max22190WriteReg(MAX22190_REG_FAULT2EN, &_max22190[_MAX22190_IDX_L], 0x3f);
   _max22190WriteReg(MAX22190_REG_FAULT2EN, &_max22190[_MAX22190_IDX_H], 0x3f);
 
+  diagPollSet(IONO_DIAG_FAULT, 100, 2);
+  diagPollSet(IONO_DIAG_OL, 100, 1);
+  diagPollSet(IONO_DIAG_OV, 100, 2);
+  diagPollSet(IONO_DIAG_STATE, 100, 0);
+  diagPollSet(IONO_DIAG_THSD, 50, 3);
+
   _ledSet = true;
   _ledVal = false;
 
@@ -543,115 +1589,135 @@ bool IonoD16Class::ready() {
 
 void IonoD16Class::process() {
   int i, j;
-  unsigned long ts, dts;
-  struct max22190Str* mi;
-  struct max14912Str* mo;
+  unsigned long ts;
+  uint16_t inputs, changed;
+#if IONO_PROFILE
+  unsigned long profUs[IONO_PHASE_NUM];
+  unsigned long profTs;
+  unsigned long profCycleTs = micros();
+  for (i = 0; i < IONO_PHASE_NUM; i++) {
+    profUs[i] = _PROF_NONE;
+  }
+#endif
 
   if (!_setupDone) {
     return;
   }
 
+  _cmdProcess();
+
   // Devices are read alternately to avoid delays between
   // subsequent SPI cycles
 
-  // WB is read always to update the inputs state
-  for (i = 0; i < _MAX22190_NUM; i++) {
-    mi = &_max22190[i];
-    _max22190ReadReg(MAX22190_REG_WB, mi, &mi->wb);
-    mi->faultMemWb |= mi->wb;
-  }
-
-  if (millis() - _processTs > 20) {
-    switch (_processStep++) {
-      case 0:
-        for (i = 0; i < _MAX22190_NUM; i++) {
-          mi = &_max22190[i];
-          _max22190ReadReg(MAX22190_REG_FAULT1, mi, &mi->fault1);
-          mi->faultMemAlrmT1 |= _getBit(mi->fault1, 3) ? 0xff : 0x00;
-          mi->faultMemAlrmT2 |= _getBit(mi->fault1, 4) ? 0xff : 0x00;
-        }
-        for (i = 0; i < _MAX22190_NUM; i++) {
-          mi = &_max22190[i];
-          if (_getBit(mi->fault1, 5)) {
-            _max22190ReadReg(MAX22190_REG_FAULT2, mi, &mi->fault2);
-            mi->faultMemOtshdn |= _getBit(mi->fault2, 4) ? 0xff : 0x00;
-          }
-        }
-        break;
-
-      case 1:
-        for (i = 0; i < _MAX14912_NUM; i++) {
-          mo = &_max14912[i];
-          _max14912ReadReg(MAX14912_REG_OL, mo, &mo->olRT, &mo->ol);
-          mo->faultMemOl |= mo->olRT;
-        }
-        break;
-
-      case 2:
-        for (i = 0; i < _MAX14912_NUM; i++) {
-          mo = &_max14912[i];
-          _max14912ReadReg(MAX14912_REG_OV, mo, &mo->ovRT, NULL);
-          mo->faultMemOv |= mo->ovRT;
-          if (mo->ovProtEn) {
-            _max14912OverVoltProt(mo);
-          }
-        }
-        break;
+  // WB is read always to update the inputs state, unless sampling
+  // at a fixed rate
+  if (_sampleItvlUs == 0 || (long) (micros() - _sampleNextTs) >= 0) {
+    _PROF_START();
+    _inputsSample();
+    _PROF_END(IONO_PHASE_INPUTS);
+  }
 
-      case 3:
-        for (i = 0; i < _MAX14912_NUM; i++) {
-          mo = &_max14912[i];
-          _max14912Cmd(_MAX14912_CMD_SET_STATE, mo, mo->outputs);
-        }
-        break;
+  if (_evEnabled) {
+    _eventsProcess();
+  }
 
-      default:
-        for (i = 0; i < _MAX14912_NUM; i++) {
-          mo = &_max14912[i];
-          _max14912ReadReg(MAX14912_REG_THSD, mo, &mo->thsdRT, &mo->thsd);
-          mo->faultMemThsd |= mo->thsdRT;
-          _max14912ThermalProt(mo);
-        }
-        _processStep = 0;
-        break;
+  for (i = 0; i < 2; i++) {
+    if (_wgnd[i].pio != NULL) {
+      _wiegandProcess(&_wgnd[i]);
     }
-
-    _processTs = millis();
   }
 
+  _PROF_START();
+  _diagProcess();
+  _PROF_END(IONO_PHASE_DIAG);
+
+  _PROF_START();
   for (i = 0; i < 16; i++) {
     if (_subscribeD[i].cb != NULL) {
       _subscribeProcess(&_subscribeD[i]);
     }
-    for (j = 0; j < 16; j++) {
-      _linkProcess(&_linkD[i][j]);
+  }
+
+  // Links are evaluated only for the inputs that changed since the
+  // previous cycle or that have a debounce pending
+  inputs = _inputsGet();
+  ts = millis();
+  changed = (inputs ^ _linkInputs) | _linkPending;
+  if (_linkChanges != _linkChangesSeen) {
+    // links added or replaced, evaluate them all
+    _linkChangesSeen = _linkChanges;
+    __sync_synchronize();
+    changed = 0xffff;
+  }
+  _linkInputs = inputs;
+  _linkPending = 0;
+  while (changed != 0) {
+    i = __builtin_ctz(changed);
+    changed &= changed - 1;
+    for (j = _linkHead[i]; j != 0; j = _link[j - 1].next) {
+      if (_linkProcess(&_link[j - 1], inputs, ts)) {
+        _linkPending |= 1 << i;
+      }
     }
   }
+  _linkTs = ts;
+  __sync_synchronize();
+  _linkCycle++;
+
   for (i = 0; i < 4; i++) {
     if (_subscribeDT[i].cb != NULL) {
       _subscribeProcess(&_subscribeDT[i]);
     }
   }
+  _PROF_END(IONO_PHASE_LINK);
 
-  ts = micros();
-  for (i = 0; i < 16; i++) {
-    if (_pwm[i].periodUs > 0) {
-      dts = ts - _pwm[i].startTs;
-      if (dts > _pwm[i].periodUs) {
-        _writeOutputProtected(i + 1, HIGH);
-        _pwm[i].startTs = micros();
-        _pwm[i].on = true;
-      } else if (_pwm[i].on && dts > _pwm[i].dutyUs) {
-        _writeOutputProtected(i + 1, LOW);
-        _pwm[i].on = false;
-      }
-    }
-  }
+  _PROF_START();
+  _pwmProcess();
+  _PROF_END(IONO_PHASE_PWM);
 
   if (_ledVal != _ledSet) {
+    _PROF_START();
     _ledCtrl(_ledSet);
     _ledVal = _ledSet;
+    _PROF_END(IONO_PHASE_LED);
   }
+
+  _snapshotPublish();
+
+#if IONO_PROFILE
+  profUs[IONO_PHASE_CYCLE] = micros() - profCycleTs;
+  _profUpdate(profUs);
+#endif
+}
+
+// Profiling =======================
+// Updated by process() once per cycle under a sequence lock, so that
+// stats() gets consistent figures from the other core
+
+void IonoD16Class::_profUpdate(unsigned long* us) {
+  struct profStr* p;
+  _profLock = _profLock + 1;
+  __sync_synchronize();
+  if (_profResetReq) {
+    memset(_prof, 0, sizeof(_prof));
+    _profResetReq = false;
+  }
+  for (int i = 0; i < IONO_PHASE_NUM; i++) {
+    if (us[i] == _PROF_NONE) {
+      continue;
+    }
+    p = &_prof[i];
+    if (p->count == 0 || us[i] < p->minUs) {
+      p->minUs = us[i];
+    }
+    if (us[i] > p->maxUs) {
+      p->maxUs = us[i];
+    }
+    p->sumUs += us[i];
+    p->count++;
+  }
+  __sync_synchronize();
+  _profLock = _profLock + 1;
 }
 
 bool IonoD16Class::pinMode(int pin, int mode, bool wbol) {
@@ -699,13 +1765,88 @@ bool IonoD16Class::pinMode(int pin, int mode, bool wbol) {
   return ok;
 }
 
+int IonoD16Class::pinModeRead(int pin) {
+  if (pin < D1 || pin > D16) {
+    return -1;
+  }
+  return _pinMode[pin - 1];
+}
+
+void IonoD16Class::outputsRefresh(unsigned long maxMs) {
+  _outputsRefreshMs = maxMs;
+}
+
+void IonoD16Class::outputsWatchdog(unsigned long keepaliveMs) {
+  _outputsKeepaliveMs = keepaliveMs;
+  ::digitalWrite(IONO_PIN_MAX14912_WD_EN, keepaliveMs != 0 ? HIGH : LOW);
+}
+
+uint32_t IonoD16Class::outputsMismatchCount() {
+  uint32_t count = 0;
+  for (int i = 0; i < _MAX14912_NUM; i++) {
+    count += _max14912[i].outputsMismatch;
+  }
+  return count;
+}
+
+bool IonoD16Class::configure(const IonoD16PinConfig* cfg) {
+  int modes[16];
+  byte locked;
+  bool ok = true;
+  bool chipOk;
+  int i, k;
+
+  for (i = 0; i < 16; i++) {
+    modes[i] = cfg[i].mode;
+    if (modes[i] != INPUT && modes[i] != OUTPUT_HS && modes[i] != OUTPUT_PP) {
+      return false;
+    }
+    if (modes[i] == OUTPUT_PP && cfg[i].wbol) {
+      //  Open-load detection works in high-side mode only
+      return false;
+    }
+  }
+  for (i = 0; i < 16; i++) {
+    if (cfg[i].join && !outputsJoinable(D1 + i, cfg)) {
+      return false;
+    }
+  }
+
+  // D1 ... D8 and D9 ... D16 are handled by distinct peripherals. As in
+  // pinMode(), the outputs of the new inputs are switched off before
+  // the inputs are configured
+  for (k = 0; k < 2; k++) {
+    chipOk = _configureOutputs(k, cfg, &locked);
+    chipOk = _configureInputs(k, cfg) && chipOk;
+    for (i = k * 8; i < (k + 1) * 8; i++) {
+      if (!chipOk || _getBit(locked, i - k * 8)) {
+        ok = false;
+      } else {
+        _pinMode[i] = modes[i];
+      }
+    }
+  }
+  return ok;
+}
+
+bool IonoD16Class::outputsJoinable(int pin, const IonoD16PinConfig* cfg) {
+  int modes[16];
+  if (pin < D1 || pin > D16 || cfg[pin - D1].mode != OUTPUT_HS) {
+    return false;
+  }
+  for (int i = 0; i < 16; i++) {
+    modes[i] = cfg[i].mode;
+  }
+  return _outputsJoinable(pin, modes);
+}
+
 bool IonoD16Class::outputsJoin(int pin, bool join) {
   struct max14912Str* m;
   int outIdx;
   if (!_max14912GetByPin(pin, &m, &outIdx)) {
     return false;
   }
-  if (join && !_outputsJoinable(pin)) {
+  if (join && !_outputsJoinable(pin, _pinMode)) {
     return false;
   }
   int bitIdx = (outIdx <= 3) ? 2 : 3;
@@ -742,6 +1883,26 @@ bool IonoD16Class::write(int pin, int val) {
   return _writeOutputProtected(pin, val);
 }
 
+bool IonoD16Class::writeMask(uint16_t mask, uint16_t values) {
+  uint16_t outMask = mask & _outputsModeMask();
+  bool ok = outMask == mask;
+  if (!_writeOutputsProtected(&_max14912[_MAX14912_IDX_L], outMask & 0xff, values & 0xff)) {
+    ok = false;
+  }
+  if (!_writeOutputsProtected(&_max14912[_MAX14912_IDX_H], outMask >> 8, values >> 8)) {
+    ok = false;
+  }
+  return ok;
+}
+
+bool IonoD16Class::writeMaskDT(byte mask, byte values) {
+  if ((mask & ~0x0f) != 0) {
+    return false;
+  }
+  gpio_put_masked((uint32_t) mask << IONO_PIN_DT1, (uint32_t) values << IONO_PIN_DT1);
+  return true;
+}
+
 bool IonoD16Class::flip(int pin) {
   int val = read(pin);
   if (val < 0) {
@@ -751,36 +1912,15 @@ bool IonoD16Class::flip(int pin) {
 }
 
 int IonoD16Class::wireBreakRead(int pin) {
-  struct max22190Str* m;
-  int ret, inIdx;
-  if (!_max22190GetByPin(pin, &m, &inIdx)) {
-    return -1;
-  }
-  ret = _getBit(m->faultMemWb, inIdx) ? HIGH : LOW;
-  _setBit(&m->faultMemWb, inIdx, false);
-  return ret;
+  return _faultReadClear(IONO_FAULT_WB, pin);
 }
 
 int IonoD16Class::openLoadRead(int pin) {
-  struct max14912Str* m;
-  int ret, outIdx;
-  if (!_max14912GetByPin(pin, &m, &outIdx)) {
-    return -1;
-  }
-  ret = _getBit(m->faultMemOl, outIdx) ? HIGH : LOW;
-  _setBit(&m->faultMemOl, outIdx, false);
-  return ret;
+  return _faultReadClear(IONO_FAULT_OL, pin);
 }
 
 int IonoD16Class::overVoltageRead(int pin) {
-  struct max14912Str* m;
-  int ret, outIdx;
-  if (!_max14912GetByPin(pin, &m, &outIdx)) {
-    return -1;
-  }
-  ret = _getBit(m->faultMemOv, outIdx) ? HIGH : LOW;
-  _setBit(&m->faultMemOv, outIdx, false);
-  return ret;
+  return _faultReadClear(IONO_FAULT_OV, pin);
 }
 
 int IonoD16Class::overVoltageLockRead(int pin) {
@@ -793,20 +1933,7 @@ int IonoD16Class::overVoltageLockRead(int pin) {
 }
 
 int IonoD16Class::thermalShutdownRead(int pin) {
-  struct max14912Str* mo;
-  struct max22190Str* mi;
-  int ret, outIdx, inIdx;
-  if (!_max14912GetByPin(pin, &mo, &outIdx)) {
-    return -1;
-  }
-  if (!_max22190GetByPin(pin, &mi, &inIdx)) {
-    return -1;
-  }
-  ret = (_getBit(mo->faultMemThsd, outIdx) ||
-          _getBit(mi->faultMemOtshdn, inIdx)) ? HIGH : LOW;
-  _setBit(&mo->faultMemThsd, outIdx, false);
-  _setBit(&mi->faultMemOtshdn, inIdx, false);
-  return ret;
+  return _faultReadClear(IONO_FAULT_THSD, pin);
 }
 
 int IonoD16Class::thermalShutdownLockRead(int pin) {
@@ -819,25 +1946,50 @@ int IonoD16Class::thermalShutdownLockRead(int pin) {
 }
 
 int IonoD16Class::alarmT1Read(int pin) {
-  struct max22190Str* m;
-  int ret, inIdx;
-  if (!_max22190GetByPin(pin, &m, &inIdx)) {
-    return -1;
-  }
-  ret = _getBit(m->faultMemAlrmT1, inIdx) ? HIGH : LOW;
-  _setBit(&m->faultMemAlrmT1, inIdx, false);
-  return ret;
+  return _faultReadClear(IONO_FAULT_ALRM_T1, pin);
 }
 
 int IonoD16Class::alarmT2Read(int pin) {
-  struct max22190Str* m;
-  int ret, inIdx;
-  if (!_max22190GetByPin(pin, &m, &inIdx)) {
-    return -1;
+  return _faultReadClear(IONO_FAULT_ALRM_T2, pin);
+}
+
+void IonoD16Class::snapshotRead(IonoD16Snapshot* s) {
+  uint32_t lock;
+  do {
+    lock = _snapLock;
+    __sync_synchronize();
+    *s = _snap;
+    __sync_synchronize();
+  } while ((lock & 1) != 0 || lock != _snapLock);
+}
+
+void IonoD16Class::faultsReadClear(IonoD16Snapshot* s, byte types) {
+  uint16_t faults[_FAULT_NUM];
+  uint16_t masks[_FAULT_NUM];
+  mutex_enter_blocking(&_faultMtx);
+  *s = _snap;
+  _snapshotFaults(s, faults, false);
+  for (int k = 0; k < _FAULT_NUM; k++) {
+    masks[k] = ((types >> k) & 1) != 0 ? faults[k] : 0;
   }
-  ret = _getBit(m->faultMemAlrmT2, inIdx) ? HIGH : LOW;
-  _setBit(&m->faultMemAlrmT2, inIdx, false);
-  return ret;
+  _faultClear(masks);
+  mutex_exit(&_faultMtx);
+}
+
+uint16_t IonoD16Class::faultsReadClearType(int type, uint16_t mask) {
+  uint16_t faults[_FAULT_NUM];
+  uint16_t masks[_FAULT_NUM];
+  if (type < 0 || type >= _FAULT_NUM) {
+    return 0;
+  }
+  mutex_enter_blocking(&_faultMtx);
+  _snapshotFaults(&_snap, faults, false);
+  for (int k = 0; k < _FAULT_NUM; k++) {
+    masks[k] = k == type ? faults[k] & mask : 0;
+  }
+  _faultClear(masks);
+  mutex_exit(&_faultMtx);
+  return masks[type];
 }
 
 bool IonoD16Class::outputsClearFaults(int pin) {
@@ -865,19 +2017,76 @@ void IonoD16Class::subscribe(int pin, unsigned long debounceMs, void (*cb)(int,
   s->lastTs = millis();
 }
 
-void IonoD16Class::link(int inPin, int outPin, int mode, unsigned long debounceMs) {
+bool IonoD16Class::link(int inPin, int outPin, int mode, unsigned long debounceMs) {
   struct linkStr* l;
-  if (inPin >= D1 && inPin <= D16 && outPin >= D1 && outPin <= D16) {
-    l = &_linkD[inPin - D1][outPin - D1];
+  volatile byte* prev;
+  int j, k;
+  if (inPin < D1 || inPin > D16 || outPin < D1 || outPin > D16 || inPin == outPin) {
+    return false;
+  }
+  if (mode < LINK_NONE || mode > LINK_FLIP_T) {
+    return false;
+  }
+  prev = &_linkHead[inPin - D1];
+  for (j = *prev; j != 0; j = *prev) {
+    if (_link[j - 1].outPin == outPin) {
+      break;
+    }
+    prev = &_link[j - 1].next;
+  }
+  if (mode == LINK_NONE && j == 0) {
+    return true;
+  }
+
+  if (mode != LINK_NONE && j != 0) {
+    // replaced in place, process() re-evaluates it from scratch
+    l = &_link[j - 1];
+    l->mode = mode;
+    l->debounceMs = debounceMs;
+    __sync_synchronize();
+    l->reset = true;
+    _linkChanges++;
+    return true;
+  }
+
+  // process() may be walking the list on the other core: a new entry
+  // is completely filled in before being spliced in, and a removed
+  // entry keeps its next index and is not reused until the walk in
+  // progress, if any, has ended
+  k = 0;
+  if (mode != LINK_NONE) {
+    for (k = 1; k <= IONO_LINK_NUM; k++) {
+      l = &_link[k - 1];
+      if (!l->used && (!l->retired || l->retiredCycle != _linkCycle)) {
+        break;
+      }
+    }
+    if (k > IONO_LINK_NUM) {
+      return false;
+    }
+    l->used = true;
+    l->retired = false;
+    l->reset = false;
+    l->inPin = inPin;
+    l->outPin = outPin;
+    l->mode = mode;
+    l->debounceMs = debounceMs;
+    l->value = -1;
+    l->pending = true;
+    l->lastTs = millis();
+    l->next = 0;
+    __sync_synchronize();
+    *prev = k;
   } else {
-    return;
+    *prev = _link[j - 1].next;
+    __sync_synchronize();
+    l = &_link[j - 1];
+    l->used = false;
+    l->retiredCycle = _linkCycle;
+    l->retired = true;
   }
-  l->inPin = inPin;
-  l->outPin = outPin;
-  l->mode = mode;
-  l->debounceMs = debounceMs;
-  l->value = -1;
-  l->lastTs = millis();
+  _linkChanges++;
+  return true;
 }
 
 void IonoD16Class::rs485TxEn(bool enabled) {
@@ -893,23 +2102,381 @@ void IonoD16Class::ledSet(bool on) {
 }
 
 bool IonoD16Class::pwmSet(int pin, int freqHz, uint16_t dutyU16) {
+  struct pwmStr* p;
   if (pin < D1 || pin > D16) {
     return false;
   }
   if (_pinMode[pin - 1] != OUTPUT_PP) {
     return false;
   }
-  _pwm[pin - 1].periodUs = 0;
+  if (dutyU16 != 0 && (freqHz <= 0 || freqHz > 1000000)) {
+    return false;
+  }
+  p = &_pwm[pin - 1];
+  p->periodUs = 0;
   if (dutyU16 == 0) {
     _writeOutputProtected(pin, LOW);
     return true;
   }
-  _pwm[pin - 1].dutyUs = (1000000ull / freqHz) * dutyU16 / 65535ull;
-  _writeOutputProtected(pin, HIGH);
-  _pwm[pin - 1].startTs = micros();
-  _pwm[pin - 1].on = true;
-  _pwm[pin - 1].periodUs = 1000000ull / freqHz;
+  unsigned long periodUs = 1000000ul / freqHz;
+  p->dutyUs = (unsigned long long) periodUs * dutyU16 / 65535ull;
+  p->riseTs = 0;
+  p->periodMeasUs = 0;
+  p->dutyErrUs = 0;
+  if (_pwmStagger) {
+    // spread the rising edges of the channels over the period
+    _writeOutputProtected(pin, LOW);
+    p->on = false;
+    p->startTs = micros() - periodUs + (periodUs * (pin - D1) / 16) + 1;
+  } else {
+    _writeOutputProtected(pin, HIGH);
+    p->startTs = micros();
+    p->riseTs = p->startTs;
+    p->on = true;
+  }
+  p->periodUs = periodUs;
+  return true;
+}
+
+void IonoD16Class::pwmStagger(bool enabled) {
+  _pwmStagger = enabled;
+}
+
+unsigned long IonoD16Class::pwmNextUs() {
+  struct pwmStr* p;
+  unsigned long ts = micros();
+  unsigned long next = 0xffffffff;
+  unsigned long dts, edge;
+  for (int i = 0; i < 16; i++) {
+    p = &_pwm[i];
+    if (p->periodUs == 0) {
+      continue;
+    }
+    dts = ts - p->startTs;
+    edge = (p->on && p->dutyUs < p->periodUs) ? p->dutyUs : p->periodUs;
+    if (dts >= edge) {
+      return 0;
+    }
+    if (edge - dts < next) {
+      next = edge - dts;
+    }
+  }
+  return next;
+}
+
+bool IonoD16Class::pwmStats(int pin, unsigned long* periodUs, long* dutyErrUs) {
+  if (pin < D1 || pin > D16) {
+    return false;
+  }
+  if (_pwm[pin - 1].periodUs == 0) {
+    return false;
+  }
+  *periodUs = _pwm[pin - 1].periodMeasUs;
+  *dutyErrUs = _pwm[pin - 1].dutyErrUs;
+  return true;
+}
+
+unsigned long IonoD16Class::spiFramesCount() {
+  return _spiFrames;
+}
+
+bool IonoD16Class::spiStats(int chip, IonoD16SpiStats* stats) {
+  struct spiLinkStr* l = _spiLinkGet(chip);
+  if (l == NULL) {
+    return false;
+  }
+  mutex_enter_blocking(&_spiMtx);
+  stats->frames = l->frames;
+  stats->crcErrors = l->crcErrors;
+  stats->retries = l->retries;
+  stats->errors = l->errors;
+  stats->clockHz = l->clockHz;
+  mutex_exit(&_spiMtx);
+  return true;
+}
+
+bool IonoD16Class::stats(IonoD16PhaseStats* stats) {
+  struct profStr prof[IONO_PHASE_NUM];
+  uint32_t lock;
+  if (!IONO_PROFILE) {
+    return false;
+  }
+  do {
+    lock = _profLock;
+    __sync_synchronize();
+    memcpy(prof, _prof, sizeof(prof));
+    __sync_synchronize();
+  } while ((lock & 1) != 0 || lock != _profLock);
+  for (int i = 0; i < IONO_PHASE_NUM; i++) {
+    stats[i].count = prof[i].count;
+    stats[i].minUs = prof[i].minUs;
+    stats[i].avgUs = prof[i].count > 0 ? prof[i].sumUs / prof[i].count : 0;
+    stats[i].maxUs = prof[i].maxUs;
+  }
+  return true;
+}
+
+void IonoD16Class::statsReset() {
+  _profResetReq = true;
+}
+
+int IonoD16Class::cmdPinMode(int pin, int mode, bool wbol) {
+  return _cmdEnqueue(_CMD_PIN_MODE, pin, mode, wbol ? 1 : 0);
+}
+
+int IonoD16Class::cmdWrite(int pin, int val) {
+  return _cmdEnqueue(_CMD_WRITE, pin, val, 0);
+}
+
+int IonoD16Class::cmdWriteMask(uint16_t mask, uint16_t values) {
+  return _cmdEnqueue(_CMD_WRITE_MASK, mask, 0, values);
+}
+
+int IonoD16Class::cmdOutputsJoin(int pin, bool join) {
+  return _cmdEnqueue(_CMD_OUTPUTS_JOIN, pin, join ? 1 : 0, 0);
+}
+
+int IonoD16Class::cmdPwmSet(int pin, int freqHz, uint16_t dutyU16) {
+  return _cmdEnqueue(_CMD_PWM_SET, pin, freqHz, dutyU16);
+}
+
+int IonoD16Class::cmdStatus(int handle) {
+  uint32_t tail = _cmdTail;
+  uint32_t queued = (_cmdHead - (uint32_t) handle) & 0x7fffffff;
+  uint32_t doneAge = (tail - (uint32_t) handle - 1) & 0x7fffffff;
+  if (handle < 0 || queued == 0 || queued > IONO_CMD_QUEUE_LEN) {
+    // never enqueued or result slot reused by a newer command
+    return IONO_CMD_UNKNOWN;
+  }
+  if (doneAge >= IONO_CMD_QUEUE_LEN) {
+    return IONO_CMD_PENDING;
+  }
+  __sync_synchronize();
+  return _cmd[handle % IONO_CMD_QUEUE_LEN].ok ? IONO_CMD_OK : IONO_CMD_FAILED;
+}
+
+void IonoD16Class::cmdCallback(void (*cb)(int, bool)) {
+  _cmdCb = cb;
+}
+
+bool IonoD16Class::diagPollSet(int reg, unsigned long periodMs, byte priority) {
+  if (reg < 0 || reg >= _DIAG_NUM) {
+    return false;
+  }
+  _diag[reg].periodMs = periodMs;
+  _diag[reg].priority = priority;
+  return true;
+}
+
+void IonoD16Class::inputsSamplingSet(unsigned long periodUs) {
+  _sampleNextTs = micros();
+  _sampleJitterUs = 0;
+  _sampleItvlUs = periodUs;
+}
+
+unsigned long IonoD16Class::inputsSamplingJitterUs() {
+  unsigned long jitter = _sampleJitterUs;
+  _sampleJitterUs = 0;
+  return jitter;
+}
+
+bool IonoD16Class::counterSetup(int pin) {
+  struct counterStr* c;
+  pio_sm_config cfg;
+  int offset;
+  if (pin < DT1 || pin > DT4) {
+    return false;
+  }
+  c = &_counter[pin - DT1];
+  if (c->pio != NULL) {
+    return true;
+  }
+  if (!_pioSmClaim(&_counterPioProgram, &c->pio, &c->sm, &offset)) {
+    c->pio = NULL;
+    return false;
+  }
+  ::pinMode(pin, INPUT);
+  cfg = pio_get_default_sm_config();
+  sm_config_set_wrap(&cfg, offset, offset + _counterPioProgram.length - 1);
+  sm_config_set_in_pins(&cfg, pin);
+  sm_config_set_jmp_pin(&cfg, pin);
+  sm_config_set_clkdiv(&cfg, 1);
+  pio_sm_set_consecutive_pindirs(c->pio, c->sm, pin, 1, false);
+  pio_sm_init(c->pio, c->sm, offset, &cfg);
+  pio_sm_exec(c->pio, c->sm, pio_encode_set(pio_x, 0));
+  pio_sm_exec(c->pio, c->sm, pio_encode_set(pio_y, 0));
+  pio_sm_set_enabled(c->pio, c->sm, true);
+  c->count = 0;
+  c->high = 0;
+  c->ts = micros();
+  return true;
+}
+
+bool IonoD16Class::counterRead(int pin, uint32_t* count) {
+  struct counterStr* c;
+  uint32_t high;
+  if (pin < DT1 || pin > DT4) {
+    return false;
+  }
+  c = &_counter[pin - DT1];
+  if (c->pio == NULL) {
+    return false;
+  }
+  _counterRaw(c, count, &high);
+  return true;
+}
+
+bool IonoD16Class::counterFrequencyRead(int pin, float* freqHz, float* duty) {
+  struct counterStr* c;
+  uint32_t count, high;
+  unsigned long ts, dts;
+  if (pin < DT1 || pin > DT4) {
+    return false;
+  }
+  c = &_counter[pin - DT1];
+  if (c->pio == NULL) {
+    return false;
+  }
+  ts = micros();
+  _counterRaw(c, &count, &high);
+  dts = ts - c->ts;
+  if (dts == 0) {
+    return false;
+  }
+  *freqHz = (count - c->count) * 1000000.0f / dts;
+  *duty = (high - c->high) * 2.0f / ((float) clock_get_hz(clk_sys) / 1000000.0f) / dts;
+  c->count = count;
+  c->high = high;
+  c->ts = ts;
   return true;
 }
 
+bool IonoD16Class::wiegandSetup(int pinD0, unsigned long itvlMinUs, unsigned long itvlMaxUs,
+    unsigned long widthMinUs, unsigned long widthMaxUs) {
+  struct wgndStr* w;
+  pio_sm_config cfg;
+  PIO pio;
+  int sm, offset;
+  if (!_wiegandGet(pinD0, &w)) {
+    return false;
+  }
+  if (w->pio != NULL) {
+    return false;
+  }
+  if (itvlMaxUs >= _WGND_ITVL_MASK || widthMaxUs >= _WGND_WIDTH_MAX) {
+    return false;
+  }
+  if (!_pioSmClaim(&_wgndPioProgram, &pio, &sm, &offset)) {
+    return false;
+  }
+  ::pinMode(pinD0, INPUT);
+  ::pinMode(pinD0 + 1, INPUT);
+  cfg = pio_get_default_sm_config();
+  sm_config_set_wrap(&cfg, offset, offset + _wgndPioProgram.length - 1);
+  sm_config_set_in_pins(&cfg, pinD0);
+  sm_config_set_in_shift(&cfg, true, false, 32);
+  sm_config_set_out_shift(&cfg, true, false, 32);
+  sm_config_set_fifo_join(&cfg, PIO_FIFO_JOIN_RX);
+  sm_config_set_clkdiv(&cfg, (float) clock_get_hz(clk_sys) / (_WGND_PIO_CYCLES_PER_US * 1000000.0f));
+  pio_sm_set_consecutive_pindirs(pio, sm, pinD0, 2, false);
+  pio_sm_init(pio, sm, offset, &cfg);
+  w->itvlMinUs = itvlMinUs;
+  w->itvlMaxUs = itvlMaxUs;
+  w->widthMinUs = widthMinUs;
+  w->widthMaxUs = widthMaxUs;
+  w->bits = 0;
+  w->data = 0;
+  w->noise = 0;
+  w->skip = false;
+  w->sm = sm;
+  pio_sm_set_enabled(pio, sm, true);
+  __sync_synchronize();
+  w->pio = pio;
+  return true;
+}
+
+int IonoD16Class::wiegandRead(int pinD0, uint64_t* data, unsigned long* ts) {
+  IonoD16WiegandFrame f;
+  int n = wiegandReadFrames(pinD0, &f, 1);
+  if (n <= 0) {
+    return n;
+  }
+  *data = f.data;
+  if (ts != NULL) {
+    *ts = f.ts;
+  }
+  return f.bits;
+}
+
+int IonoD16Class::wiegandReadFrames(int pinD0, IonoD16WiegandFrame* frames, int maxNum) {
+  struct wgndStr* w;
+  uint32_t tail, head;
+  int n = 0;
+  if (!_wiegandGet(pinD0, &w) || w->pio == NULL) {
+    return -1;
+  }
+  tail = w->tail;
+  head = w->head;
+  __sync_synchronize();
+  while (tail != head && n < maxNum) {
+    frames[n++] = w->frames[tail % IONO_WGND_QUEUE_LEN];
+    tail++;
+  }
+  __sync_synchronize();
+  w->tail = tail;
+  return n;
+}
+
+int IonoD16Class::wiegandAvailable(int pinD0) {
+  struct wgndStr* w;
+  if (!_wiegandGet(pinD0, &w) || w->pio == NULL) {
+    return -1;
+  }
+  return w->head - w->tail;
+}
+
+int IonoD16Class::wiegandNoise(int pinD0) {
+  struct wgndStr* w;
+  int noise;
+  if (!_wiegandGet(pinD0, &w)) {
+    return -1;
+  }
+  noise = w->noise;
+  w->noise = 0;
+  return noise;
+}
+
+void IonoD16Class::eventsEnable(bool enabled) {
+  _evInputs = _inputsGet();
+  for (int i = 0; i < 4; i++) {
+    if (::digitalRead(DT1 + i) == HIGH) {
+      _evInputs |= 1ul << (16 + i);
+    }
+  }
+  _evPending = 0;
+  _evEnabled = enabled;
+}
+
+void IonoD16Class::eventsDebounceSet(unsigned long debounceMs) {
+  _evDebounceUs = debounceMs * 1000;
+}
+
+int IonoD16Class::eventsRead(IonoD16Event* events, int maxNum) {
+  uint32_t tail = _evTail;
+  uint32_t head = _evHead;
+  int n = 0;
+  __sync_synchronize();
+  while (tail != head && n < maxNum) {
+    events[n++] = _ev[tail % IONO_EVENT_QUEUE_LEN];
+    tail++;
+  }
+  __sync_synchronize();
+  _evTail = tail;
+  return n;
+}
+
+unsigned long IonoD16Class::eventsLost() {
+  return _evLost;
+}
+
 IonoD16Class Iono;
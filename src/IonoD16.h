@@ -18,6 +18,7 @@
 
 #include <SPI.h>
 #include <mutex>
+#include <hardware/pio.h>
 
 #define IONO_PIN_DT1 26
 #define IONO_PIN_DT2 27
@@ -49,6 +50,41 @@
 
 #define IONO_RS485 SERIAL_PORT_HARDWARE
 
+// SPI bus used for the MAX22190/MAX14912 peripherals, can be
+// overridden at build time, e.g. to plug in a simulated bus
+#ifndef IONO_SPI
+#define IONO_SPI SPI
+#endif
+
+// SPI clock of the I/O peripherals. With IONO_SPI_ADAPTIVE defined as 1
+// each chip starts at IONO_SPI_CLOCK_MAX_HZ and its clock is halved, down
+// to IONO_SPI_CLOCK_HZ, whenever IONO_SPI_CRC_ERR_MAX CRC errors are
+// detected within IONO_SPI_CRC_WINDOW frames
+#ifndef IONO_SPI_CLOCK_HZ
+#define IONO_SPI_CLOCK_HZ 1000000
+#endif
+
+#ifndef IONO_SPI_ADAPTIVE
+#define IONO_SPI_ADAPTIVE 0
+#endif
+
+#ifndef IONO_SPI_CLOCK_MAX_HZ
+#define IONO_SPI_CLOCK_MAX_HZ 10000000
+#endif
+
+#ifndef IONO_SPI_CRC_WINDOW
+#define IONO_SPI_CRC_WINDOW 1000
+#endif
+
+#ifndef IONO_SPI_CRC_ERR_MAX
+#define IONO_SPI_CRC_ERR_MAX 3
+#endif
+
+#define IONO_SPI_DIL 0
+#define IONO_SPI_DIH 1
+#define IONO_SPI_DOL 2
+#define IONO_SPI_DOH 3
+
 #define D1 1
 #define D2 2
 #define D3 3
@@ -80,8 +116,142 @@
 #define LINK_FLIP_L 4
 #define LINK_FLIP_T 5
 
+// Links pool, by default one entry for each pair of distinct pins
+#ifndef IONO_LINK_NUM
+#define IONO_LINK_NUM 240
+#endif
+
+static_assert(IONO_LINK_NUM <= 255, "IONO_LINK_NUM exceeds the byte link indexes");
+
+// Maximum interval between two frames to each outputs peripheral while
+// its watchdog is armed
+#ifndef IONO_OUTPUTS_KEEPALIVE_MS
+#define IONO_OUTPUTS_KEEPALIVE_MS 20
+#endif
+
+// Length of the input events queue, must be a power of 2
+#ifndef IONO_EVENT_QUEUE_LEN
+#define IONO_EVENT_QUEUE_LEN 64
+#endif
+
+// Length of the commands queue, must be a power of 2
+#ifndef IONO_CMD_QUEUE_LEN
+#define IONO_CMD_QUEUE_LEN 16
+#endif
+
+// Length of the Wiegand frames queue of each reader, must be a power of 2
+#ifndef IONO_WGND_QUEUE_LEN
+#define IONO_WGND_QUEUE_LEN 8
+#endif
+
+#define IONO_WGND_NOISE_ITVL 1
+#define IONO_WGND_NOISE_WIDTH 2
+#define IONO_WGND_NOISE_OVERFLOW 3
+#define IONO_WGND_NOISE_QUEUE 4
+#define IONO_WGND_NOISE_FIFO 5
+
+#define IONO_WGND_RAW 0
+#define IONO_WGND_VALID 1
+#define IONO_WGND_PARITY_ERR 2
+
+// Define as 1 at build time to collect the timing of the process()
+// phases, see stats()
+#ifndef IONO_PROFILE
+#define IONO_PROFILE 0
+#endif
+
+#define IONO_PHASE_INPUTS 0
+#define IONO_PHASE_DIAG 1
+#define IONO_PHASE_LINK 2
+#define IONO_PHASE_PWM 3
+#define IONO_PHASE_LED 4
+#define IONO_PHASE_CYCLE 5
+#define IONO_PHASE_NUM 6
+
+#define IONO_CMD_OK 1
+#define IONO_CMD_FAILED 0
+#define IONO_CMD_PENDING -1
+#define IONO_CMD_UNKNOWN -2
+
+#define IONO_FAULT_WB 0
+#define IONO_FAULT_OL 1
+#define IONO_FAULT_OV 2
+#define IONO_FAULT_THSD 3
+#define IONO_FAULT_ALRM_T1 4
+#define IONO_FAULT_ALRM_T2 5
+
+#define IONO_DIAG_FAULT 0
+#define IONO_DIAG_OL 1
+#define IONO_DIAG_OV 2
+#define IONO_DIAG_STATE 3
+#define IONO_DIAG_THSD 4
+
 #define _MAX22190_NUM 2
 #define _MAX14912_NUM 2
+#define _DIAG_NUM 5
+#define _FAULT_NUM 6
+
+// Consistent image of the I/O and fault state, published once per
+// process() cycle. Bit 0 = D1 ... bit 15 = D16
+struct IonoD16Snapshot {
+  uint32_t seq;
+  unsigned long ts;
+  uint16_t inputs;
+  unsigned long inputsTs;
+  uint16_t outputs;
+  uint16_t wireBreak;
+  uint16_t openLoad;
+  uint16_t overVoltage;
+  uint16_t thermalShutdown;
+  uint16_t alarmT1;
+  uint16_t alarmT2;
+  uint16_t overVoltageLock;
+  uint16_t thermalShutdownLock;
+  byte error;
+};
+
+// Input state change
+struct IonoD16Event {
+  uint32_t seq;
+  unsigned long ts;
+  byte pin;
+  byte value;
+};
+
+// Wiegand frame, last bit received in the LSB of data. Facility code
+// and card number are decoded for the 26, 34 and 37 bits formats
+struct IonoD16WiegandFrame {
+  unsigned long ts;
+  byte bits;
+  byte status;
+  uint16_t facility;
+  uint32_t card;
+  uint64_t data;
+};
+
+// Mode of a D1 ... D16 pin, see configure()
+struct IonoD16PinConfig {
+  int mode;
+  bool wbol;
+  bool join;
+};
+
+// Execution time of a process() phase
+struct IonoD16PhaseStats {
+  uint32_t count;
+  uint32_t minUs;
+  uint32_t avgUs;
+  uint32_t maxUs;
+};
+
+// SPI link counters of a peripheral chip
+struct IonoD16SpiStats {
+  uint32_t frames;
+  uint32_t crcErrors;
+  uint32_t retries;
+  uint32_t errors;
+  uint32_t clockHz;
+};
 
 class IonoD16Class {
   public:
@@ -93,6 +263,8 @@ class IonoD16Class {
     void process();
     int read(int);
     bool write(int, int);
+    bool writeMask(uint16_t, uint16_t);
+    bool writeMaskDT(byte, byte);
     bool flip(int);
     int wireBreakRead(int);
     int openLoadRead(int);
@@ -102,42 +274,102 @@ class IonoD16Class {
     int thermalShutdownLockRead(int);
     int alarmT1Read(int);
     int alarmT2Read(int);
+    void snapshotRead(IonoD16Snapshot*);
+    void faultsReadClear(IonoD16Snapshot*, byte types=0xff);
+    uint16_t faultsReadClearType(int, uint16_t);
     bool pinMode(int, int, bool wbol=false);
+    int pinModeRead(int);
     bool outputsJoin(int, bool join=true);
+    bool configure(const IonoD16PinConfig*);
+    bool outputsJoinable(int, const IonoD16PinConfig*);
     bool outputsClearFaults(int);
+    void outputsRefresh(unsigned long);
+    void outputsWatchdog(unsigned long);
+    uint32_t outputsMismatchCount();
     void subscribe(int, unsigned long, void (*)(int, int));
-    void link(int, int, int, unsigned long);
+    bool link(int, int, int, unsigned long);
     void ledSet(bool);
     bool pwmSet(int, int, uint16_t);
+    void pwmStagger(bool);
+    bool diagPollSet(int, unsigned long, byte);
+    bool counterSetup(int);
+    bool counterRead(int, uint32_t*);
+    bool counterFrequencyRead(int, float*, float*);
+    bool wiegandSetup(int, unsigned long, unsigned long, unsigned long, unsigned long);
+    int wiegandRead(int, uint64_t*, unsigned long*);
+    int wiegandReadFrames(int, IonoD16WiegandFrame*, int);
+    int wiegandAvailable(int);
+    int wiegandNoise(int);
+    void eventsEnable(bool);
+    void eventsDebounceSet(unsigned long);
+    int eventsRead(IonoD16Event*, int);
+    unsigned long eventsLost();
+    void inputsSamplingSet(unsigned long);
+    unsigned long inputsSamplingJitterUs();
+    unsigned long pwmNextUs();
+    bool pwmStats(int, unsigned long*, long*);
+    int cmdPinMode(int, int, bool wbol=false);
+    int cmdWrite(int, int);
+    int cmdWriteMask(uint16_t, uint16_t);
+    int cmdOutputsJoin(int, bool join=true);
+    int cmdPwmSet(int, int, uint16_t);
+    int cmdStatus(int);
+    void cmdCallback(void (*)(int, bool));
+    unsigned long spiFramesCount();
+    bool spiStats(int, IonoD16SpiStats*);
+    bool stats(IonoD16PhaseStats*);
+    void statsReset();
 
   private:
     bool _setupDone;
     int _pinMode[16];
     SPISettings _spiSettings;
     mutex_t _spiMtx;
-    byte _max14912ReadStatCrc;
+    unsigned long _spiFrames;
+    struct spiLinkStr {
+      SPISettings settings;
+      uint32_t clockHz;
+      uint32_t frames;
+      uint32_t crcErrors;
+      uint32_t retries;
+      uint32_t errors;
+      uint32_t winFrames;
+      uint32_t winCrcErrors;
+    };
     bool _ledSet;
     bool _ledVal;
-    unsigned long _processTs;
-    int _processStep;
+    unsigned long _sampleItvlUs;
+    unsigned long _sampleNextTs;
+    unsigned long _sampleJitterUs;
+    unsigned long _inputsTs;
+    unsigned long _outputsRefreshMs;
+    unsigned long _outputsKeepaliveMs;
+    struct diagStr {
+      unsigned long periodMs;
+      byte priority;
+      unsigned long lastTs;
+    } _diag[_DIAG_NUM];
+    uint32_t _diagFaults;
+    bool _diagFast;
+    unsigned long _diagFastTs;
     struct max22190Str {
       int pinCs;
+      struct spiLinkStr link;
       bool error;
       byte inputs;
       byte wb;
       byte fault1;
       byte fault2;
       byte cfgFlt[8];
-      byte faultMemWb;
-      byte faultMemAlrmT1;
-      byte faultMemAlrmT2;
-      byte faultMemOtshdn;
     } _max22190[_MAX22190_NUM];
     struct max14912Str {
       int pinCs;
+      struct spiLinkStr link;
       bool error;
       byte outputs;
       byte outputsUser;
+      uint32_t outputsMismatch;
+      volatile unsigned long frameTs;
       bool clearFaults;
       bool ovProtEn;
       byte ol;
@@ -151,11 +383,59 @@ class IonoD16Class {
       byte cfgJoin;
       byte ovLock;
       byte thsdLock;
-      byte faultMemOl;
-      byte faultMemOv;
-      byte faultMemThsd;
       unsigned long lockTs[8];
     } _max14912[_MAX14912_NUM];
+    uint16_t _faultMem[_FAULT_NUM];
+    uint16_t _faultNew[_FAULT_NUM];
+    mutex_t _faultMtx;
+    volatile uint32_t _snapLock;
+    uint32_t _snapSeq;
+    IonoD16Snapshot _snap;
+    struct counterStr {
+      PIO pio;
+      int sm;
+      uint32_t count;
+      uint32_t high;
+      unsigned long ts;
+    } _counter[4];
+    struct wgndStr {
+      PIO pio;
+      int sm;
+      unsigned long itvlMinUs;
+      unsigned long itvlMaxUs;
+      unsigned long widthMinUs;
+      unsigned long widthMaxUs;
+      uint64_t data;
+      byte bits;
+      unsigned long ts;
+      unsigned long lastTs;
+      unsigned long lastWidthUs;
+      volatile byte noise;
+      bool skip;
+      IonoD16WiegandFrame frames[IONO_WGND_QUEUE_LEN];
+      volatile uint32_t head;
+      volatile uint32_t tail;
+    } _wgnd[2];
+    bool _evEnabled;
+    uint32_t _evInputs;
+    uint32_t _evPending;
+    unsigned long _evPendingTs[20];
+    volatile unsigned long _evDebounceUs;
+    uint32_t _evSeq;
+    IonoD16Event _ev[IONO_EVENT_QUEUE_LEN];
+    volatile uint32_t _evHead;
+    volatile uint32_t _evTail;
+    volatile unsigned long _evLost;
+    struct cmdStr {
+      byte type;
+      bool ok;
+      int a;
+      int b;
+      uint16_t c;
+    } _cmd[IONO_CMD_QUEUE_LEN];
+    volatile uint32_t _cmdHead;
+    volatile uint32_t _cmdTail;
+    void (*_cmdCb)(int, bool);
     struct subscribeStr {
       int pin;
       void (*cb)(int, int);
@@ -164,46 +444,104 @@ class IonoD16Class {
       unsigned long lastTs;
     } _subscribeD[16], _subscribeDT[4];
     struct linkStr {
-      int inPin;
-      int outPin;
-      int mode;
+      byte inPin;
+      byte outPin;
+      byte mode;
+      int8_t value;
+      bool pending;
+      volatile bool reset;
+      byte next;
+      bool used;
+      bool retired;
+      uint32_t retiredCycle;
       unsigned long debounceMs;
-      int value;
       unsigned long lastTs;
-    } _linkD[16][16];
+    } _link[IONO_LINK_NUM];
+    volatile byte _linkHead[16];
+    volatile uint32_t _linkChanges;
+    uint32_t _linkChangesSeen;
+    volatile uint32_t _linkCycle;
+    uint16_t _linkPending;
+    uint16_t _linkInputs;
+    unsigned long _linkTs;
     struct pwmStr {
       unsigned long periodUs;
       unsigned long dutyUs;
       unsigned long startTs;
       bool on;
+      unsigned long riseTs;
+      unsigned long periodMeasUs;
+      long dutyErrUs;
     } _pwm[16];
+    bool _pwmStagger;
+    struct profStr {
+      uint32_t count;
+      uint32_t minUs;
+      uint32_t maxUs;
+      uint64_t sumUs;
+    } _prof[IONO_PHASE_NUM];
+    volatile uint32_t _profLock;
+    volatile bool _profResetReq;
 
     bool _getBit(byte, int);
+    byte _bitRev(byte);
     void _setBit(byte*, int, bool);
-    void _spiTransaction(int, byte, byte, byte, byte*, byte*, byte*);
+    void _spiTransaction(int, const SPISettings&, byte, byte, byte, byte*, byte*, byte*);
+    void _spiLinkInit(struct spiLinkStr*);
+    void _spiLinkUpdate(struct spiLinkStr*, int, int, bool);
+    struct spiLinkStr* _spiLinkGet(int);
     byte _max22190Crc(byte, byte, byte);
-    bool _max22190SpiTransaction(struct max22190Str*, byte*, byte*);
-    bool _max22190ReadReg(byte, struct max22190Str*, byte*);
+    bool _max22190SpiTransaction(struct max22190Str*, byte*, byte*, byte);
+    bool _max22190ReadReg(byte, struct max22190Str*, byte*, byte*);
     bool _max22190WriteReg(byte, struct max22190Str*, byte);
     bool _max22190GetByPin(int, struct max22190Str**, int*);
-    byte _max14912CrcLoop(byte, byte);
     byte _max14912Crc(byte, byte);
-    bool _max14912SpiTransaction(bool, struct max14912Str*, byte*, byte*);
+    bool _max14912SpiTransaction(struct max14912Str*, byte*, byte*);
+    void _max14912ReadFrame(struct max14912Str*, int, bool, byte*, byte*, byte*);
+    bool _max14912ReadRegs(struct max14912Str*, const byte*, int, byte*, byte*);
     bool _max14912ReadReg(byte, struct max14912Str*, byte*, byte*);
     bool _max14912Cmd(byte, struct max14912Str*, byte);
     bool _max14912Config(struct max14912Str*, byte, byte, byte);
     bool _max14912GetByPin(int, struct max14912Str**, int*);
     bool _max14912OutputSet(struct max14912Str*, int, bool);
+    uint16_t _outputsModeMask();
     bool _max14912ModePPSet(struct max14912Str*, int, bool);
     void _max14912OverVoltProt(struct max14912Str*);
     void _max14912ThermalProt(struct max14912Str*);
     bool _pinModeInput(int, bool);
     bool _pinModeOutputProtected(int, int, bool);
     bool _writeOutputProtected(int, int);
-    bool _outputsJoinable(int);
+    bool _writeOutputsProtected(struct max14912Str*, byte, byte);
+    bool _outputsJoinable(int, const int*);
+    bool _configureInputs(int, const IonoD16PinConfig*);
+    bool _configureOutputs(int, const IonoD16PinConfig*, byte*);
+    bool _diagUsable(int);
+    uint32_t _diagFaultBits();
+    void _diagProcess();
+    void _diagRun(uint32_t);
+    void _diagOutputsRead(int, uint32_t);
+    bool _pioSmClaim(const pio_program_t*, PIO*, int*, int*);
+    void _counterRaw(struct counterStr*, uint32_t*, uint32_t*);
+    bool _wiegandGet(int, struct wgndStr**);
+    void _wiegandDecode(IonoD16WiegandFrame*);
+    void _wiegandFrameEnd(struct wgndStr*);
+    void _wiegandPulse(struct wgndStr*, uint32_t, unsigned long);
+    void _wiegandProcess(struct wgndStr*);
+    void _inputsSample();
+    void _eventsProcess();
+    void _pwmProcess();
     void _subscribeProcess(struct subscribeStr*);
-    void _linkProcess(struct linkStr*);
+    uint16_t _inputsGet();
+    bool _linkProcess(struct linkStr*, uint16_t, unsigned long);
     void _ledCtrl(bool);
+    int _cmdEnqueue(byte, int, int, uint16_t);
+    void _cmdProcess();
+    void _faultLatch(int, uint16_t);
+    void _faultClear(const uint16_t*);
+    int _faultReadClear(int, int);
+    void _snapshotFaults(IonoD16Snapshot*, uint16_t*, bool);
+    void _snapshotPublish();
+    void _profUpdate(unsigned long*);
 };
 
 extern IonoD16Class Iono;